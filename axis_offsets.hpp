@@ -12,7 +12,7 @@ class axis_offsets {
     crystal * crystalp;
     vec3 unit_direction;
 public:
-    int label;
+    int label = 0;
     std::vector<double> offsets;
     struct pref {
         particle * p;
@@ -23,6 +23,10 @@ public:
     axis_offsets(crystal * crystalp, vec3 direction) : crystalp(crystalp), unit_direction(direction.unit()) {
     }
 
+    vec3 direction() const {
+        return unit_direction;
+    }
+
     void add_particle(particle * p, int state=0) {
         particles.emplace_back(p, state);
     }
@@ -30,12 +34,21 @@ public:
     void measure() {
         offsets.clear();
         for (auto & ref: particles) {
-            vec3 diff = crystalp->space.difference(ref.p->cell->center, ref.p->pos);
+            vec3 diff = crystalp->offset(ref.p);
             double proj = diff * unit_direction;
             offsets.push_back(proj);
         }
     }
 
+    /* scalars for convergence monitoring, the offsets themselves */
+    std::vector<double> observables() const {
+        return offsets;
+    }
+
+    std::vector<const axis_offsets*> profiles() const {
+        return {this};
+    }
+
     double sum() {
         double total = 0;
         for (const auto & offset : offsets) {
@@ -57,7 +70,7 @@ public:
     }
 
     void add_trace(lattice_cell * cell, double radius=0.5) {
-        vec3 center = cell->center;
+        vec3 center = crystalp->center(cell);
         assert(particles.size() == 0);
         vec3 probe = center;
         int niter = 0;
@@ -66,7 +79,7 @@ public:
                 break;
             }
             for (particle * p : crystalp->particles) {
-                if (crystalp->space.distance(probe, p->cell->center) < radius) {
+                if (crystalp->space.distance(probe, crystalp->center(crystalp->cell_of(p))) < radius) {
                     bool already_added = false;
                     for (const auto & qref: particles) {
                         if (p == qref.p) {
@@ -75,9 +88,9 @@ public:
                         }
                     }
                     if (!already_added) {
-                        double d = crystalp->space.difference(center, p->cell->center) * unit_direction;
+                        double d = crystalp->space.difference(center, crystalp->center(crystalp->cell_of(p))) * unit_direction;
                         int state = d > 0 ? 1 : -1;
-                        if (p->cell == cell) state = 0;
+                        if (crystalp->cell_of(p) == cell) state = 0;
                         particles.emplace_back(p, state);
                     }
                 }
@@ -86,8 +99,8 @@ public:
             niter += 1;
         }
         std::sort(std::begin(particles), std::end(particles), [&](pref & a, pref & b) -> bool {
-                double ad = crystalp->space.difference(center, a.p->cell->center) * unit_direction;
-                double bd = crystalp->space.difference(center, b.p->cell->center) * unit_direction;
+                double ad = crystalp->space.difference(center, crystalp->center(crystalp->cell_of(a.p))) * unit_direction;
+                double bd = crystalp->space.difference(center, crystalp->center(crystalp->cell_of(b.p))) * unit_direction;
                 return ad < bd;
         });
     }
@@ -45,6 +45,18 @@ public:
         });
     }
 
+    /* scalars for convergence monitoring: the axis sums, smallest first */
+    std::vector<double> observables() const {
+        std::vector<double> ret;
+        for (axis_offsets * ao : sorted) ret.push_back(ao->sum());
+        return ret;
+    }
+
+    /* the axes in label order */
+    std::vector<const axis_offsets*> profiles() const {
+        return {&p1, &p2, &p3, &p4};
+    }
+
     void write(std::ostream & out) const {
         auto write_axis = [&](axis_offsets * ao) {
             int idx = 0;
@@ -0,0 +1,204 @@
+#ifndef BOND_ORDER_HPP
+#define BOND_ORDER_HPP
+
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "crystal.hpp"
+#include "parallel.hpp"
+
+class spherical_harmonics {
+    /* Y_lm(r) = K_lm Q_lm(z/r) ((x + iy)/r)^m for m >= 0, where
+     * Q_lm = (-1)^m d^m P_l / dx^m is a polynomial, so no trigonometry
+     * is needed per bond. coefficients are tabulated at construction */
+    std::vector<std::vector<double>> coefficients; /* [m][power] */
+public:
+    int l;
+    spherical_harmonics(int l) : l(l) {
+        /* legendre polynomial through the bonnet recursion */
+        std::vector<double> p0 = {1}, p1 = {0, 1};
+        std::vector<double> pl = l == 0 ? p0 : p1;
+        for (int n = 1; n < l; n++) {
+            std::vector<double> next(n + 2, 0);
+            for (int i = 0; i <= n; i++) next[i + 1] += (2*n + 1) * p1[i] / (n + 1);
+            for (int i = 0; i < n; i++) next[i] -= n * p0[i] / (n + 1);
+            p0 = p1;
+            p1 = next;
+            pl = next;
+        }
+        std::vector<double> derivative = pl;
+        for (int m = 0; m <= l; m++) {
+            double k = sqrt((2*l + 1) / (4 * M_PI) * std::tgamma(l - m + 1) / std::tgamma(l + m + 1));
+            std::vector<double> c(derivative.size());
+            for (size_t i = 0; i < c.size(); i++) c[i] = (m % 2 ? -1 : 1) * k * derivative[i];
+            coefficients.push_back(c);
+            std::vector<double> next(std::max<size_t>(1, derivative.size() - 1), 0);
+            for (size_t i = 1; i < derivative.size(); i++) next[i - 1] = i * derivative[i];
+            derivative = next;
+        }
+    }
+
+    /* adds Y_lm(bond) for m = 0..l to out */
+    void accumulate(const vec3 & bond, std::complex<double> * out) const {
+        double r = bond.length();
+        double z = bond.z / r;
+        std::complex<double> e(bond.x / r, bond.y / r);
+        std::complex<double> em(1, 0);
+        for (int m = 0; m <= l; m++) {
+            const auto & c = coefficients[m];
+            double q = 0;
+            for (size_t i = c.size(); i-- > 0;) q = q * z + c[i];
+            out[m] += q * em;
+            em *= e;
+        }
+    }
+};
+
+class bond_order {
+    /* steinhardt q4, q6 and normalised w6 per particle, from the neighbours
+     * within r_cut or, when r_cut is 0, the n_nearest closest ones */
+    crystal * crystalp;
+    spherical_harmonics y4, y6;
+    std::vector<double> w6_symbols; /* (6 6 6; m1 m2 -m1-m2) indexed [m1+6][m2+6] */
+
+    static double wigner_3j(int j1, int j2, int j3, int m1, int m2, int m3) {
+        /* racah formula */
+        if (m1 + m2 + m3 != 0) return 0;
+        if (abs(m1) > j1 || abs(m2) > j2 || abs(m3) > j3) return 0;
+        auto f = [](int n) { return std::tgamma(n + 1); };
+        double triangle = f(j1 + j2 - j3) * f(j1 - j2 + j3) * f(-j1 + j2 + j3) / f(j1 + j2 + j3 + 1);
+        double pre = sqrt(triangle * f(j1 + m1) * f(j1 - m1) * f(j2 + m2) * f(j2 - m2) * f(j3 + m3) * f(j3 - m3));
+        double sum = 0;
+        int kmin = std::max({0, j2 - j3 - m1, j1 - j3 + m2});
+        int kmax = std::min({j1 + j2 - j3, j1 - m1, j2 + m2});
+        for (int k = kmin; k <= kmax; k++) {
+            sum += (k % 2 ? -1 : 1) / (f(k) * f(j1 + j2 - j3 - k) * f(j1 - m1 - k) * f(j2 + m2 - k)
+                    * f(j3 - j2 + m1 + k) * f(j3 - j1 - m2 + k));
+        }
+        return ((j1 - j2 - m3) % 2 ? -1 : 1) * pre * sum;
+    }
+
+    static std::complex<double> full(const std::complex<double> * q, int m) {
+        /* q_l,-m = (-1)^m conj(q_lm) */
+        return m >= 0 ? q[m] : (m % 2 ? -1. : 1.) * std::conj(q[-m]);
+    }
+
+    std::vector<const particle*> neighbours(const particle * a) const {
+        std::vector<std::pair<double, const particle*>> candidates;
+        auto add = [&](const particle * b) {
+            if (b != a) candidates.emplace_back(crystalp->separation(a, b).length(), b);
+        };
+        if (crystalp->wigner_seitz_constraint) {
+            for (const lattice_cell * nn : crystalp->neighbours(crystalp->cell_of(a))) {
+                for (const particle * b : crystalp->members(nn)) add(b);
+            }
+            for (const particle * b : crystalp->members(crystalp->cell_of(a))) add(b);
+        } else {
+            for (const particle * b : crystalp->particles) add(b);
+        }
+        std::vector<const particle*> ret;
+        if (r_cut > 0) {
+            for (const auto & c : candidates) {
+                if (c.first < r_cut) ret.push_back(c.second);
+            }
+        } else {
+            size_t n = std::min<size_t>(n_nearest, candidates.size());
+            std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end());
+            for (size_t i = 0; i < n; i++) ret.push_back(candidates[i].second);
+        }
+        return ret;
+    }
+
+public:
+    double r_cut;
+    int n_nearest;
+    unsigned nthreads;
+    int nbins;
+    std::vector<double> q4, q6, w6; /* last sample, in crystal->particles order */
+    std::vector<double> q4_histogram, q6_histogram, w6_histogram; /* q in [0, 1], w6 in [-0.25, 0.25] */
+    int64_t nsamples = 0;
+
+    bond_order(crystal * crystalp, double r_cut=0, int n_nearest=12, int nbins=100, unsigned nthreads=0) :
+        crystalp(crystalp), y4(4), y6(6), r_cut(r_cut), n_nearest(n_nearest), nthreads(nthreads), nbins(nbins),
+        q4_histogram(nbins, 0), q6_histogram(nbins, 0), w6_histogram(nbins, 0) {
+        if (r_cut > crystalp->pair_range()) throw "bond_order: r_cut beyond the pairs the neighbour cells hold";
+        w6_symbols.assign(13 * 13, 0);
+        for (int m1 = -6; m1 <= 6; m1++) {
+            for (int m2 = -6; m2 <= 6; m2++) {
+                w6_symbols[(m1 + 6) * 13 + m2 + 6] = wigner_3j(6, 6, 6, m1, m2, -m1 - m2);
+            }
+        }
+    }
+
+    void measure() {
+        const auto & particles = crystalp->particles;
+        size_t n = particles.size();
+        q4.assign(n, 0);
+        q6.assign(n, 0);
+        w6.assign(n, 0);
+        parallel_for(n, nthreads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                const particle * a = particles[i];
+                std::complex<double> q4m[5] = {}, q6m[7] = {};
+                auto bonds = neighbours(a);
+                if (bonds.empty()) continue;
+                for (const particle * b : bonds) {
+                    vec3 bond = crystalp->separation(a, b);
+                    y4.accumulate(bond, q4m);
+                    y6.accumulate(bond, q6m);
+                }
+                double s4 = 0, s6 = 0;
+                for (int m = 0; m <= 4; m++) s4 += (m ? 2 : 1) * std::norm(q4m[m]);
+                for (int m = 0; m <= 6; m++) s6 += (m ? 2 : 1) * std::norm(q6m[m]);
+                double nb = bonds.size();
+                q4[i] = sqrt(4 * M_PI / 9 * s4) / nb;
+                q6[i] = sqrt(4 * M_PI / 13 * s6) / nb;
+                double w = 0;
+                for (int m1 = -6; m1 <= 6; m1++) {
+                    for (int m2 = std::max(-6, -6 - m1); m2 <= std::min(6, 6 - m1); m2++) {
+                        w += w6_symbols[(m1 + 6) * 13 + m2 + 6] *
+                            (full(q6m, m1) * full(q6m, m2) * full(q6m, -m1 - m2)).real();
+                    }
+                }
+                w6[i] = s6 > 0 ? w / pow(s6, 1.5) : 0;
+            }
+        });
+        auto bin = [&](std::vector<double> & histogram, double value, double lo, double hi) {
+            int b = (value - lo) / (hi - lo) * nbins;
+            histogram[std::min(std::max(b, 0), nbins - 1)] += 1;
+        };
+        for (size_t i = 0; i < n; i++) {
+            bin(q4_histogram, q4[i], 0, 1);
+            bin(q6_histogram, q6[i], 0, 1);
+            bin(w6_histogram, w6[i], -0.25, 0.25);
+        }
+        nsamples += 1;
+    }
+
+    /* binary: int32 nbins, int64 nsamples, double q4[nbins], q6[nbins], w6[nbins] */
+    void write_histograms(const std::string & filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        int32_t nb = nbins;
+        out.write((const char*)&nb, sizeof(nb));
+        out.write((const char*)&nsamples, sizeof(nsamples));
+        out.write((const char*)q4_histogram.data(), nbins * sizeof(double));
+        out.write((const char*)q6_histogram.data(), nbins * sizeof(double));
+        out.write((const char*)w6_histogram.data(), nbins * sizeof(double));
+    }
+
+    /* binary: int32 n, then per particle: float q4, q6, w6 of the last sample */
+    void write_particles(const std::string & filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        int32_t n = q4.size();
+        out.write((const char*)&n, sizeof(n));
+        for (int32_t i = 0; i < n; i++) {
+            float record[3] = {(float)q4[i], (float)q6[i], (float)w6[i]};
+            out.write((const char*)record, sizeof(record));
+        }
+    }
+};
+
+#endif
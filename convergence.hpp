@@ -0,0 +1,130 @@
+#ifndef CONVERGENCE_HPP
+#define CONVERGENCE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class convergence_monitor {
+    /* per block samples of a few scalar observables. the equilibration
+     * period is found with the marginal standard error rule (MSER) on every
+     * observable, and the error of the mean over the rest comes from the
+     * integrated autocorrelation time with sokal's automatic window. the
+     * run has converged when every observable has target_samples
+     * independent samples and, where one is set, reached its error bar */
+    std::vector<std::vector<double>> series; /* [observable][block] */
+
+public:
+    struct estimate {
+        double mean;
+        double error; /* of the mean */
+        double tau; /* integrated autocorrelation time in blocks */
+        double effective_samples;
+    };
+
+    std::vector<std::string> names;
+    std::vector<double> target_errors; /* absolute, 0 for none */
+    double target_samples;
+
+    convergence_monitor(const std::vector<std::string> & names, const std::vector<double> & target_errors,
+            double target_samples=100) :
+        series(names.size()), names(names), target_errors(target_errors), target_samples(target_samples) {
+        assert(names.size() == target_errors.size());
+    }
+
+    void add(const std::vector<double> & values) {
+        if (values.size() != series.size()) throw "convergence_monitor: observable count changed";
+        for (size_t i = 0; i < values.size(); i++) series[i].push_back(values[i]);
+    }
+
+    size_t samples() const {
+        return series.empty() ? 0 : series[0].size();
+    }
+
+    /* MSER truncation of one observable: the d <= n/2 minimising the
+     * squared standard error of the mean of x[d:], var / (n - d) */
+    size_t mser(size_t observable) const {
+        const auto & x = series[observable];
+        size_t n = x.size();
+        if (n < 4) return 0;
+        std::vector<double> sum(n + 1, 0), sum2(n + 1, 0);
+        for (size_t i = n; i-- > 0;) {
+            sum[i] = sum[i + 1] + x[i];
+            sum2[i] = sum2[i + 1] + x[i] * x[i];
+        }
+        size_t best = 0;
+        double best_value = INFINITY;
+        for (size_t d = 0; d <= n / 2; d++) {
+            double m = n - d;
+            double value = (sum2[d] - sum[d] * sum[d] / m) / (m * m);
+            if (value < best_value) {
+                best_value = value;
+                best = d;
+            }
+        }
+        return best;
+    }
+
+    /* blocks discarded for every observable */
+    size_t equilibration() const {
+        size_t ret = 0;
+        for (size_t i = 0; i < series.size(); i++) ret = std::max(ret, mser(i));
+        return ret;
+    }
+
+    estimate measure(size_t observable, size_t start) const {
+        const auto & x = series[observable];
+        size_t n = x.size() - std::min(start, x.size());
+        estimate ret = {0, INFINITY, 0.5, 0};
+        if (n < 2) return ret;
+        for (size_t i = start; i < x.size(); i++) ret.mean += x[i] / n;
+        double c0 = 0;
+        for (size_t i = start; i < x.size(); i++) c0 += (x[i] - ret.mean) * (x[i] - ret.mean) / n;
+        if (c0 == 0) {
+            ret.error = 0;
+            ret.effective_samples = n;
+            return ret;
+        }
+        /* smallest window M with M >= 5 tau(M) */
+        double tau = 0.5;
+        for (size_t t = 1; t < n; t++) {
+            double c = 0;
+            for (size_t i = start; i + t < x.size(); i++) c += (x[i] - ret.mean) * (x[i + t] - ret.mean);
+            tau += c / (n - t) / c0;
+            if (t >= 5 * tau) break;
+        }
+        ret.tau = std::max(tau, 0.5);
+        ret.effective_samples = n / (2 * ret.tau);
+        ret.error = sqrt(c0 * n / (n - 1.) / ret.effective_samples);
+        return ret;
+    }
+
+    bool converged() const {
+        size_t start = equilibration();
+        for (size_t i = 0; i < series.size(); i++) {
+            estimate e = measure(i, start);
+            if (e.effective_samples < target_samples) return false;
+            if (target_errors[i] > 0 && e.error > target_errors[i]) return false;
+        }
+        return true;
+    }
+
+    void write(std::ostream & out) const {
+        size_t start = equilibration();
+        out << "blocks " << samples() << "\n"
+            << "equilibration " << start << "\n"
+            << "converged " << converged() << "\n"
+            << "# observable mean error tau effective_samples target_error\n";
+        for (size_t i = 0; i < series.size(); i++) {
+            estimate e = measure(i, start);
+            out << names[i] << " " << e.mean << " " << e.error << " " << e.tau << " "
+                << e.effective_samples << " " << target_errors[i] << "\n";
+        }
+        out << std::flush;
+    }
+};
+
+#endif
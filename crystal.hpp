@@ -1,8 +1,13 @@
 #ifndef CRYSTAL_HPP
 #define CRYSTAL_HPP
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <numeric>
+#include <random>
 
 #include "vec3.hpp"
 #include "particle.hpp"
@@ -10,52 +15,987 @@
 #include "lattice_cell.hpp"
 #include "matrix3.hpp"
 #include "periodic_space.hpp"
+#include "energy_validation.hpp"
 
 class crystal {
-    crystal(periodic_space space) : space(space) { }
-    void init(int n1, int n2, int n3, double a, lattice_definition & unitcell, double nncell_cutoff) {
+    crystal(periodic_space space) : space(space) {
+        cells.owner = this;
+        particles.owner = this;
+    }
+    /* particles and cells are 32 bit slots in contiguous storage that is
+     * reserved up front and never reallocated, so pointers into it stay
+     * valid. a cell holds its first particle and the particles chain on
+     * through particle::next. removed particles leave a slot for the next
+     * interstitial */
+    std::vector<particle> particle_storage;
+    std::vector<lattice_cell> cell_storage;
+    std::vector<uint32_t> free_particles;
+    int next_particle_id = 0;
+
+    /* the cells fill a lattice: cell_keys holds the lattice key
+     * ((n1 e2 + n2) e3 + n3) nbasis + basis of every cell slot and
+     * lattice_slots the slot of every key */
+    int lattice_e1 = 0, lattice_e2 = 0, lattice_e3 = 0, lattice_nbasis = 0;
+    std::vector<uint32_t> cell_keys;
+    std::vector<uint32_t> lattice_slots;
+    std::vector<vec3> basis_vectors;
+
+    /* plain crystals keep the position of every particle slot, the centre
+     * and the neighbour list of every cell slot */
+    std::vector<vec3> positions;
+    std::vector<vec3> centers;
+    std::vector<std::vector<uint32_t>> neighbour_lists;
+
+    /* compact crystals keep the offset of every particle from its cell
+     * centre in units of offset_quantum, which the wigner seitz constraint
+     * bounds by maximum_displacement; the quantum leaves four times that.
+     * the centres follow from the lattice key and the neighbours of a cell
+     * are the stencil of its basis: lattice offsets closest first with the
+     * separation of the centres, the same for every cell of that basis by
+     * translation, so the kernels need no minimum image until the box
+     * gets too small for them, see wrap_offsets */
+    struct quantised_offset {
+        int32_t x, y, z;
+    };
+    struct stencil_entry {
+        int32_t d1, d2, d3, basis;
+        vec3 delta; /* from the centre of the cell to that of the neighbour */
+    };
+    bool compact = false;
+    std::vector<quantised_offset> offsets;
+    double offset_quantum = 0;
+    std::vector<std::vector<stencil_entry>> stencils; /* per basis */
+    bool wrap_offsets = false; /* a stencil separation and two offsets reach the inscribed radius */
+    static constexpr double offset_steps = 1 << 29; /* per maximum_displacement */
+
+    uint32_t slot(const particle * p) const { return p - particle_storage.data(); }
+    uint32_t slot(const lattice_cell * cell) const { return cell - cell_storage.data(); }
+
+    size_t lattice_key(int i1, int i2, int i3, int basis) const {
+        return (((size_t)i1 * lattice_e2 + i2) * lattice_e3 + i3) * lattice_nbasis + basis;
+    }
+
+    void lattice_coordinates(uint32_t key, int & i1, int & i2, int & i3, int & basis) const {
+        basis = key % lattice_nbasis;
+        key /= lattice_nbasis;
+        i3 = key % lattice_e3;
+        key /= lattice_e3;
+        i2 = key % lattice_e2;
+        i1 = key / lattice_e2;
+    }
+
+    /* offsets come from cells of one box, so one wrap suffices */
+    uint32_t stencil_slot(int i1, int i2, int i3, const stencil_entry & e) const {
+        i1 += e.d1;
+        i2 += e.d2;
+        i3 += e.d3;
+        if (i1 < 0) i1 += lattice_e1; else if (i1 >= lattice_e1) i1 -= lattice_e1;
+        if (i2 < 0) i2 += lattice_e2; else if (i2 >= lattice_e2) i2 -= lattice_e2;
+        if (i3 < 0) i3 += lattice_e3; else if (i3 >= lattice_e3) i3 -= lattice_e3;
+        return lattice_slots[lattice_key(i1, i2, i3, e.basis)];
+    }
+
+    /* the neighbour cells of one cell slot for the kernels, from its list or
+     * from the stencil when COMPACT, with the separation of the centres */
+    template<bool COMPACT>
+    class neighbour_cells {
+        const crystal * owner;
+        const std::vector<uint32_t> * list = nullptr;
+        const std::vector<stencil_entry> * stencil = nullptr;
+        int i1 = 0, i2 = 0, i3 = 0;
+    public:
+        neighbour_cells(const crystal * owner, uint32_t cell) : owner(owner) {
+            if constexpr (COMPACT) {
+                int basis;
+                owner->lattice_coordinates(owner->cell_keys[cell], i1, i2, i3, basis);
+                stencil = &owner->stencils[basis];
+            } else {
+                list = &owner->neighbour_lists[cell];
+            }
+        }
+        size_t size() const {
+            if constexpr (COMPACT) return stencil->size();
+            else return list->size();
+        }
+        uint32_t operator[](size_t i) const {
+            if constexpr (COMPACT) return owner->stencil_slot(i1, i2, i3, (*stencil)[i]);
+            else return (*list)[i];
+        }
+        const vec3 & delta(size_t i) const { return (*stencil)[i].delta; }
+    };
+
+    static uint64_t morton_key(int i1, int i2, int i3) {
+        auto spread = [](uint64_t x) {
+            x &= 0x1fffff;
+            x = (x | x << 32) & 0x1f00000000ffff;
+            x = (x | x << 16) & 0x1f0000ff0000ff;
+            x = (x | x << 8) & 0x100f00f00f00f00f;
+            x = (x | x << 4) & 0x10c30c30c30c30c3;
+            x = (x | x << 2) & 0x1249249249249249;
+            return x;
+        };
+        return spread(i1) | spread(i2) << 1 | spread(i3) << 2;
+    }
+
+    /* the separation of two offsets across a stencil entry, its minimum
+     * image once a squeezed box brings another image closer */
+    template<bool ORTHO>
+    vec3 stencil_image(const vec3 & d) const {
+        return wrap_offsets ? space.difference_kernel<ORTHO>(vec3(), d) : d;
+    }
+
+    vec3 decode(const quantised_offset & o) const {
+        return vec3(o.x, o.y, o.z) * offset_quantum;
+    }
+
+    /* the nearest quantised offset, saturated far outside any cell */
+    quantised_offset encode(const vec3 & x) const {
+        double limit = 2147483647.;
+        auto step = [&](double v) {
+            return (int32_t)lround(std::min(std::max(v / offset_quantum, -limit), limit));
+        };
+        return {step(x.x), step(x.y), step(x.z)};
+    }
+
+    /* offset of p moved by shift as it is stored, the kernels and
+     * contains() of compact crystals evaluate a move where it lands */
+    vec3 trial_offset(const particle * p, vec3 shift) const {
+        return decode(encode(decode(offsets[slot(p)]) + shift));
+    }
+
+    /* whether an offset from the centre of cell lies in its wigner seitz
+     * cell, against the stencil separations */
+    bool inside(const lattice_cell * cell, const vec3 & x) const {
+        double d1 = x * x;
+        for (const stencil_entry & e : stencils[cell_keys[slot(cell)] % lattice_nbasis]) {
+            vec3 y = wrap_offsets ? space.difference(e.delta, x) : x - e.delta;
+            if (y * y < d1) return false;
+        }
+        return true;
+    }
+
+    void store_offset(const particle * p, const vec3 & x) {
+        double limit = offset_quantum * 2147483647.;
+        if (std::abs(x.x) >= limit || std::abs(x.y) >= limit || std::abs(x.z) >= limit) {
+            throw "crystal: offset from the cell centre beyond the quantisation range";
+        }
+        offsets[slot(p)] = encode(x);
+    }
+
+    /* a new quantum for the wigner seitz radius, the offsets kept */
+    void requantise(double radius) {
+        double quantum = radius / offset_steps;
+        if (quantum == offset_quantum) return;
+        std::vector<vec3> x(offsets.size());
+        for (size_t i = 0; i < offsets.size(); i++) x[i] = decode(offsets[i]);
+        offset_quantum = quantum;
+        for (size_t i = 0; i < offsets.size(); i++) {
+            if (particle_storage[i].cell != particle::none) store_offset(&particle_storage[i], x[i]);
+        }
+    }
+
+    void append(uint32_t cell, uint32_t p) {
+        particle_storage[p].cell = cell;
+        particle_storage[p].next = particle::none;
+        uint32_t * link = &cell_storage[cell].first;
+        while (*link != particle::none) link = &particle_storage[*link].next;
+        *link = p;
+    }
+
+    void init(int n1, int n2, int n3, double a, lattice_definition & unitcell, double nncell_cutoff, bool compact) {
+        this->compact = compact;
+        basis_vectors = unitcell.basis_vectors;
+        lattice_e1 = n1;
+        lattice_e2 = n2;
+        lattice_e3 = n3;
+        lattice_nbasis = basis_vectors.size();
+        size_t ncells = (size_t)n1 * n2 * n3 * basis_vectors.size();
+        size_t nparticles = ncells + ncells / 4 + 64;
+        if (nparticles >= particle::none) throw "crystal: more sites than 32 bit slots hold";
+        cell_storage.reserve(ncells);
+        cell_keys.reserve(ncells);
+        particle_storage.reserve(nparticles);
+        particles.slots.reserve(ncells);
+        if (compact) {
+            offsets.reserve(nparticles);
+        } else {
+            positions.reserve(nparticles);
+            centers.reserve(ncells);
+        }
         for (int i1 = 0; i1 < n1; i1++) {
             for (int i2 = 0; i2 < n2; i2++) {
                 for (int i3 = 0; i3 < n3; i3++) {
-                    for (size_t i4 = 0; i4 < unitcell.basis_vectors.size(); i4++) {
-                        vec3 n(i1, i2, i3);
-                        vec3 nb = n + unitcell.basis_vectors[i4];
-                        lattice_cell * cell = new lattice_cell();
-                        particle * p = new particle();
-                        cell->n = n;
-                        cell->nb = nb;
-                        cell->owner = this;
-                        p->pos = cell->center = space.project(nb);
-                        p->cell = cell;
-                        p->owner = this;
-                        cell->basis = i4;
-                        cell->particles.push_back(p);
-                        cells.push_back(cell);
+                    for (size_t i4 = 0; i4 < basis_vectors.size(); i4++) {
+                        uint32_t cell = cell_storage.size();
+                        cell_storage.emplace_back();
+                        cell_keys.push_back(lattice_key(i1, i2, i3, i4));
+                        if (!compact) centers.push_back(space.project(vec3(i1, i2, i3) + basis_vectors[i4]));
+                        particle * p = allocate_particle();
+                        append(cell, slot(p));
+                        if (!compact) positions[slot(p)] = centers.back();
                         particles.push_back(p);
                     }
                 }
             }
         }
-        for (auto a : cells) {
-            for (const auto b : cells) {
-                double d = space.distance(a->center, b->center);
-                if (a == b || d > nncell_cutoff) continue;
-                a->nearest_neighbours.push_back(b);
+        lattice_slots.resize(ncells);
+        for (size_t i = 0; i < ncells; i++) lattice_slots[i] = i;
+        if (compact) offset_quantum = wigner_seitz_radius() / offset_steps;
+        find_neighbours(nncell_cutoff);
+    }
+
+    /* every cell other than a within range, closest first, so bounded energy
+     * sums see the large terms early */
+    void find_neighbours(uint32_t a, double range, const std::vector<uint32_t> & candidates) {
+        auto & nn = neighbour_lists[a];
+        nn.clear();
+        for (uint32_t b : candidates) {
+            if (a == b || space.distance(centers[a], centers[b]) > range) continue;
+            nn.push_back(b);
+        }
+        std::stable_sort(nn.begin(), nn.end(), [&](uint32_t x, uint32_t y) {
+            return space.distance(centers[a], centers[x]) < space.distance(centers[a], centers[y]);
+        });
+        nn.shrink_to_fit();
+    }
+
+    /* the cells form a periodic lattice, so one brute force search per basis
+     * gives the lattice offsets of the neighbours of every cell with that
+     * basis. the candidates they point to are filtered and sorted with the
+     * distances of the cell itself, in slot order, which reproduces the
+     * brute force lists in O(N) instead of O(N^2). compact crystals keep
+     * the offsets as stencils */
+    void find_neighbours(double range) {
+        std::vector<bool> done(lattice_nbasis, false);
+        std::vector<int> coordinates(4 * cells.size());
+        for (size_t i = 0; i < cells.size(); i++) {
+            int * c = &coordinates[4 * i];
+            lattice_coordinates(cell_keys[i], c[0], c[1], c[2], c[3]);
+        }
+        if (compact) {
+            stencils.assign(lattice_nbasis, {});
+            for (uint32_t r = 0; r < cells.size(); r++) {
+                const int * cr = &coordinates[4 * r];
+                if (done[cr[3]]) continue;
+                done[cr[3]] = true;
+                std::vector<std::pair<double, stencil_entry>> found;
+                vec3 c = center(&cell_storage[r]);
+                for (uint32_t b = 0; b < cells.size(); b++) {
+                    const int * cb = &coordinates[4 * b];
+                    vec3 delta = space.difference(c, center(&cell_storage[b]));
+                    double d = delta.length();
+                    if (r == b || d > range) continue;
+                    found.push_back({d, {cb[0] - cr[0], cb[1] - cr[1], cb[2] - cr[2], cb[3], delta}});
+                }
+                std::stable_sort(found.begin(), found.end(), [](const auto & x, const auto & y) { return x.first < y.first; });
+                for (const auto & f : found) stencils[cr[3]].push_back(f.second);
+            }
+        } else {
+            neighbour_lists.resize(cells.size());
+            /* per basis: lattice index offset and basis of every candidate */
+            std::vector<std::vector<std::array<int, 4>>> lattice_offsets(lattice_nbasis);
+            double margin = range * (1 + 1e-9) + 1e-12;
+            for (uint32_t r = 0; r < cells.size(); r++) {
+                const int * cr = &coordinates[4 * r];
+                if (done[cr[3]]) continue;
+                done[cr[3]] = true;
+                for (uint32_t b = 0; b < cells.size(); b++) {
+                    const int * cb = &coordinates[4 * b];
+                    if (space.distance(centers[r], centers[b]) > margin) continue;
+                    lattice_offsets[cr[3]].push_back({cb[0] - cr[0], cb[1] - cr[1], cb[2] - cr[2], cb[3]});
+                }
+            }
+            std::vector<uint32_t> candidates;
+            for (uint32_t a = 0; a < cells.size(); a++) {
+                const int * ca = &coordinates[4 * a];
+                candidates.clear();
+                for (const auto & o : lattice_offsets[ca[3]]) {
+                    int i1 = ((ca[0] + o[0]) % lattice_e1 + lattice_e1) % lattice_e1;
+                    int i2 = ((ca[1] + o[1]) % lattice_e2 + lattice_e2) % lattice_e2;
+                    int i3 = ((ca[2] + o[2]) % lattice_e3 + lattice_e3) % lattice_e3;
+                    candidates.push_back(lattice_slots[lattice_key(i1, i2, i3, o[3])]);
+                }
+                std::sort(candidates.begin(), candidates.end());
+                find_neighbours(a, range, candidates);
             }
         }
+        neighbour_range = range;
+        neighbour_rebuilds += 1;
+        wrap_offsets = compact && range + 2*maximum_displacement >= space.inscribed_radius();
     }
+
+    /* shrinking only drops the far end of every list, growing searches again */
+    void set_neighbour_range(double range) {
+        if (range > neighbour_range) {
+            find_neighbours(range);
+            return;
+        }
+        if (compact) {
+            for (auto & stencil : stencils) {
+                while (!stencil.empty() && stencil.back().delta.length() > range) stencil.pop_back();
+            }
+        } else {
+            for (uint32_t a = 0; a < cells.size(); a++) {
+                auto & nn = neighbour_lists[a];
+                while (!nn.empty() && space.distance(centers[a], centers[nn.back()]) > range) nn.pop_back();
+                nn.shrink_to_fit();
+            }
+        }
+        neighbour_range = range;
+        wrap_offsets = compact && range + 2*maximum_displacement >= space.inscribed_radius();
+    }
+
 public:
+    /* the live particles as 32 bit slots, handed out as pointers */
+    class particle_list {
+        friend class crystal;
+        crystal * owner = nullptr;
+        std::vector<uint32_t> slots;
+    public:
+        size_t size() const { return slots.size(); }
+        bool empty() const { return slots.empty(); }
+        particle * operator[](size_t i) const { return &owner->particle_storage[slots[i]]; }
+        void push_back(const particle * p) { slots.push_back(owner->slot(p)); }
+        struct iterator {
+            const particle_list * list;
+            size_t i;
+            particle * operator*() const { return (*list)[i]; }
+            iterator & operator++() { i++; return *this; }
+            bool operator!=(const iterator & other) const { return i != other.i; }
+        };
+        iterator begin() const { return {this, 0}; }
+        iterator end() const { return {this, size()}; }
+    };
+
+    /* every cell, in slot order; cells are never removed */
+    class cell_list {
+        friend class crystal;
+        crystal * owner = nullptr;
+    public:
+        size_t size() const { return owner->cell_storage.size(); }
+        lattice_cell * operator[](size_t i) const { return &owner->cell_storage[i]; }
+        struct iterator {
+            lattice_cell * cell;
+            lattice_cell * operator*() const { return cell; }
+            iterator & operator++() { cell++; return *this; }
+            bool operator!=(const iterator & other) const { return cell != other.cell; }
+        };
+        iterator begin() const { return {owner->cell_storage.data()}; }
+        iterator end() const { return {owner->cell_storage.data() + size()}; }
+    };
+
+    /* the particles of one cell, in the order they came */
+    class member_view {
+        const crystal * owner;
+        uint32_t first;
+    public:
+        member_view(const crystal * owner, uint32_t first) : owner(owner), first(first) { }
+        struct iterator {
+            const crystal * owner;
+            uint32_t p;
+            particle * operator*() const { return const_cast<particle*>(&owner->particle_storage[p]); }
+            iterator & operator++() { p = owner->particle_storage[p].next; return *this; }
+            bool operator!=(const iterator & other) const { return p != other.p; }
+        };
+        iterator begin() const { return {owner, first}; }
+        iterator end() const { return {owner, particle::none}; }
+        bool empty() const { return first == particle::none; }
+        size_t size() const {
+            size_t ret = 0;
+            for (uint32_t p = first; p != particle::none; p = owner->particle_storage[p].next) ret++;
+            return ret;
+        }
+        particle * operator[](size_t i) const {
+            auto it = begin();
+            while (i--) ++it;
+            return *it;
+        }
+    };
+
     enum potential_type { STAR, HERTZ };
     potential_type potential_type = HERTZ;
     periodic_space space;
-    std::vector<lattice_cell*> cells;
-    std::vector<particle*> particles;
+    cell_list cells;
+    particle_list particles;
 
-    double potential_sigma;
-    double potential_epsilon; /* or f for star */
+    double potential_sigma = 1;
+    double potential_epsilon = 1; /* or f for star */
 
     double wigner_seitz_constraint = true;
 
+    /* pair interactions vanish beyond potential_cutoff and are shifted down by
+     * potential_shift, set by fit_cutoff() for the star potential */
+    double potential_cutoff = INFINITY;
+    double potential_shift = 0;
+    /* per particle energy the truncated star tail may miss, 0 keeps the
+     * neighbour cell range given to build() */
+    double cutoff_tolerance = 0;
+    /* neighbour cells reach potential_cutoff + 2 displacement_skin, so no
+     * pair within the cutoff is missed while every particle stays within
+     * displacement_skin of its cell centre, and at least the face
+     * neighbours plus the skin; cover() grows it on demand */
+    double displacement_skin = INFINITY;
+    double maximum_displacement = INFINITY; /* the wigner seitz radius */
+    double face_distance = 0; /* farthest cell sharing a wigner seitz face */
+    double neighbour_range = 0;
+    int neighbour_rebuilds = 0;
+    /* sampled cross checks of the neighbour sums, mutable because the
+     * energy functions are const; one crystal is only used from one thread */
+    mutable energy_validation validation;
+
+    lattice_cell * cell_of(const particle * p) const {
+        return const_cast<lattice_cell*>(&cell_storage[p->cell]);
+    }
+
+    member_view members(const lattice_cell * cell) const {
+        return member_view(this, cell->first);
+    }
+
+    /* lattice index (n1, n2, n3) and basis of a cell */
+    vec3 lattice_index(const lattice_cell * cell) const {
+        int i1, i2, i3, basis;
+        lattice_coordinates(cell_keys[slot(cell)], i1, i2, i3, basis);
+        return vec3(i1, i2, i3);
+    }
+
+    int basis(const lattice_cell * cell) const {
+        return cell_keys[slot(cell)] % lattice_nbasis;
+    }
+
+    vec3 center(const lattice_cell * cell) const {
+        if (!compact) return centers[slot(cell)];
+        int i1, i2, i3, basis;
+        lattice_coordinates(cell_keys[slot(cell)], i1, i2, i3, basis);
+        return space.project(vec3(i1, i2, i3) + basis_vectors[basis]);
+    }
+
+    vec3 position(const particle * p) const {
+        if (!compact) return positions[slot(p)];
+        return space.clip(center(cell_of(p)) + decode(offsets[slot(p)]));
+    }
+
+    /* from the centre of its cell */
+    vec3 offset(const particle * p) const {
+        if (!compact) return space.difference(centers[p->cell], positions[slot(p)]);
+        return decode(offsets[slot(p)]);
+    }
+
+    /* minimum image vector from a to b */
+    vec3 separation(const particle * a, const particle * b) const {
+        return space.difference(position(a), position(b));
+    }
+
+    double displacement(const particle * p) const {
+        if (!compact) return space.distance(positions[slot(p)], centers[p->cell]);
+        return decode(offsets[slot(p)]).length();
+    }
+
+    /* puts p at pos inside the box, which has to lie within its cell for
+     * compact crystals */
+    void place(particle * p, const vec3 & pos) {
+        if (!compact) positions[slot(p)] = pos;
+        else store_offset(p, space.difference(center(cell_of(p)), pos));
+    }
+
+    void move(particle * p, const vec3 & shift) {
+        if (!compact) positions[slot(p)] = space.clip(positions[slot(p)] + shift);
+        else store_offset(p, decode(offsets[slot(p)]) + shift);
+    }
+
+    /* the neighbour cells of a cell closest first, for compact crystals
+     * and the rest alike; the kernels use neighbour_cells instead */
+    class neighbour_view {
+        const crystal * owner;
+        const lattice_cell * cell;
+    public:
+        neighbour_view(const crystal * owner, const lattice_cell * cell) : owner(owner), cell(cell) { }
+        size_t size() const {
+            return owner->compact ? owner->stencils[owner->basis(cell)].size() : owner->neighbour_lists[owner->slot(cell)].size();
+        }
+        lattice_cell * operator[](size_t i) const {
+            uint32_t nn;
+            if (owner->compact) {
+                int i1, i2, i3, basis;
+                owner->lattice_coordinates(owner->cell_keys[owner->slot(cell)], i1, i2, i3, basis);
+                nn = owner->stencil_slot(i1, i2, i3, owner->stencils[basis][i]);
+            } else {
+                nn = owner->neighbour_lists[owner->slot(cell)][i];
+            }
+            return const_cast<lattice_cell*>(&owner->cell_storage[nn]);
+        }
+        struct iterator {
+            const neighbour_view * view;
+            size_t i;
+            lattice_cell * operator*() const { return (*view)[i]; }
+            iterator & operator++() { i++; return *this; }
+            bool operator!=(const iterator & other) const { return i != other.i; }
+        };
+        iterator begin() const { return {this, 0}; }
+        iterator end() const { return {this, size()}; }
+    };
+
+    neighbour_view neighbours(const lattice_cell * cell) const {
+        return neighbour_view(this, cell);
+    }
+
+    bool compact_storage() const {
+        return compact;
+    }
+
+    /* software prefetch of what the kernels read around p, one level of
+     * indirection per stage: 0 the particle, 1 its cell and position, 2 the
+     * neighbour list of the cell (the lattice slots of the stencil in
+     * compact crystals) and its first particle, 3 the neighbour cells and
+     * the positions in the own cell, 4 the first particles of the neighbour
+     * cells and 5 their positions. stage k only follows indices that stage
+     * k - 1 fetched, so the stages issued in order some moves apart rarely
+     * wait on memory themselves. a hint only, stale slots are harmless */
+    static constexpr int prefetch_stages = 6;
+
+    void prefetch(const particle * p, int stage) const {
+        if (stage == 0) {
+            __builtin_prefetch(p);
+            return;
+        }
+        uint32_t cell = p->cell;
+        if (cell == particle::none) return;
+        if (stage == 1) {
+            __builtin_prefetch(&cell_storage[cell]);
+            if (compact) {
+                __builtin_prefetch(&offsets[slot(p)]);
+                __builtin_prefetch(&cell_keys[cell]);
+            } else {
+                __builtin_prefetch(&positions[slot(p)]);
+                __builtin_prefetch(&neighbour_lists[cell]);
+            }
+            return;
+        }
+        if (!wigner_seitz_constraint) return;
+        auto position_of = [&](uint32_t q) -> const void * {
+            return compact ? (const void*)&offsets[q] : (const void*)&positions[q];
+        };
+        auto each_neighbour = [&](auto f) {
+            if (compact) {
+                neighbour_cells<true> nn(this, cell);
+                for (size_t i = 0; i < nn.size(); i++) f(nn[i]);
+            } else {
+                for (uint32_t nn : neighbour_lists[cell]) f(nn);
+            }
+        };
+        switch (stage) {
+            case 2:
+                if (cell_storage[cell].first != particle::none) __builtin_prefetch(&particle_storage[cell_storage[cell].first]);
+                if (!compact) {
+                    const auto & nn = neighbour_lists[cell];
+                    for (size_t i = 0; i < nn.size(); i += 16) __builtin_prefetch(nn.data() + i);
+                } else {
+                    int i1, i2, i3, basis;
+                    lattice_coordinates(cell_keys[cell], i1, i2, i3, basis);
+                    for (const stencil_entry & e : stencils[basis]) {
+                        int j1 = i1 + e.d1, j2 = i2 + e.d2, j3 = i3 + e.d3;
+                        if (j1 < 0) j1 += lattice_e1; else if (j1 >= lattice_e1) j1 -= lattice_e1;
+                        if (j2 < 0) j2 += lattice_e2; else if (j2 >= lattice_e2) j2 -= lattice_e2;
+                        if (j3 < 0) j3 += lattice_e3; else if (j3 >= lattice_e3) j3 -= lattice_e3;
+                        __builtin_prefetch(&lattice_slots[lattice_key(j1, j2, j3, e.basis)]);
+                    }
+                }
+                break;
+            case 3:
+                for (uint32_t q = cell_storage[cell].first; q != particle::none; q = particle_storage[q].next) {
+                    __builtin_prefetch(position_of(q));
+                }
+                each_neighbour([&](uint32_t nn) { __builtin_prefetch(&cell_storage[nn]); });
+                break;
+            case 4:
+                each_neighbour([&](uint32_t nn) {
+                    if (cell_storage[nn].first != particle::none) __builtin_prefetch(&particle_storage[cell_storage[nn].first]);
+                });
+                break;
+            case 5:
+                each_neighbour([&](uint32_t nn) {
+                    for (uint32_t q = cell_storage[nn].first; q != particle::none; q = particle_storage[q].next) {
+                        __builtin_prefetch(position_of(q));
+                    }
+                });
+                break;
+        }
+    }
+
+    /* heap and slot bytes per component, vector capacities included */
+    struct memory_usage {
+        size_t particles; /* particle slots */
+        size_t positions; /* positions, or quantised offsets of compact crystals */
+        size_t cells; /* cell slots */
+        size_t lattice; /* lattice keys and slots, and the centres unless compact */
+        size_t neighbour_lists; /* per cell neighbour lists */
+        size_t stencils; /* per basis stencils of compact crystals */
+        size_t indices; /* live and free particle slot lists */
+        size_t total;
+        size_t sites;
+    };
+
+    memory_usage memory() const {
+        memory_usage ret;
+        ret.particles = particle_storage.capacity() * sizeof(particle);
+        ret.positions = positions.capacity() * sizeof(vec3) + offsets.capacity() * sizeof(quantised_offset);
+        ret.cells = cell_storage.capacity() * sizeof(lattice_cell);
+        ret.lattice = (cell_keys.capacity() + lattice_slots.capacity()) * sizeof(uint32_t)
+            + centers.capacity() * sizeof(vec3) + basis_vectors.capacity() * sizeof(vec3);
+        ret.neighbour_lists = neighbour_lists.capacity() * sizeof(neighbour_lists[0]);
+        for (const auto & nn : neighbour_lists) ret.neighbour_lists += nn.capacity() * sizeof(uint32_t);
+        ret.stencils = stencils.capacity() * sizeof(stencils[0]);
+        for (const auto & stencil : stencils) ret.stencils += stencil.capacity() * sizeof(stencil_entry);
+        ret.indices = (particles.slots.capacity() + free_particles.capacity()) * sizeof(uint32_t);
+        ret.total = ret.particles + ret.positions + ret.cells + ret.lattice + ret.neighbour_lists + ret.stencils + ret.indices;
+        ret.sites = cells.size();
+        return ret;
+    }
+
+private:
+    /* energy kernels are specialised on potential, constraint mode and
+     * geometry; select_kernels() picks one set after configuration. the
+     * bounded variants return early once the sum reaches limit, which is
+     * exact because every pair term is positive */
+    typedef double (crystal::*particle_energy_fn)(const particle *, vec3, double) const;
+    typedef double (crystal::*two_particle_energy_fn)(const particle *, const particle *, vec3, vec3, double) const;
+    typedef vec3 (crystal::*particle_force_fn)(const particle *) const;
+    particle_energy_fn particle_energy_impl = nullptr;
+    particle_energy_fn bounded_particle_energy_impl = nullptr;
+    two_particle_energy_fn two_particle_energy_impl = nullptr;
+    two_particle_energy_fn bounded_two_particle_energy_impl = nullptr;
+    particle_force_fn particle_force_impl = nullptr;
+    enum potential_type kernel_potential_type = HERTZ;
+    bool kernel_wigner_seitz_constraint = true;
+    double kernel_sigma = 0;
+    double kernel_epsilon = 0;
+    double kernel_cutoff = 0;
+    double kernel_shift = 0;
+    /* constants of the star potential, refreshed by select_kernels() */
+    double star_prefactor = 0;
+    double star_1_1psf2 = 0;
+    double star_decay = 0;
+
+    template<enum potential_type P>
+    double potential_kernel(double dist) const {
+        if constexpr (P == HERTZ) {
+            double x = 1. - dist/potential_sigma;
+            return dist >= potential_sigma ? 0 : potential_epsilon*x*x*sqrt(x);
+        } else {
+            if (dist >= potential_cutoff) return 0;
+            return (dist <= potential_sigma ?
+                star_prefactor * (-std::log(dist/potential_sigma) + star_1_1psf2) :
+                star_prefactor * (potential_sigma/dist)*star_1_1psf2 * exp(-star_decay*(dist-potential_sigma)))
+                - potential_shift;
+        }
+    }
+
+    /* dV/dr */
+    template<enum potential_type P>
+    double potential_derivative_kernel(double dist) const {
+        if constexpr (P == HERTZ) {
+            double x = 1. - dist/potential_sigma;
+            return dist >= potential_sigma ? 0 : -2.5*potential_epsilon/potential_sigma*x*sqrt(x);
+        } else {
+            if (dist >= potential_cutoff) return 0;
+            return dist <= potential_sigma ?
+                -star_prefactor / dist :
+                -(potential_kernel<STAR>(dist) + potential_shift) * (1./dist + star_decay);
+        }
+    }
+
+    /* d2V/dr2 */
+    template<enum potential_type P>
+    double potential_curvature_kernel(double dist) const {
+        if constexpr (P == HERTZ) {
+            double x = 1. - dist/potential_sigma;
+            return dist >= potential_sigma ? 0 : 3.75*potential_epsilon/(potential_sigma*potential_sigma)*sqrt(x);
+        } else {
+            if (dist >= potential_cutoff) return 0;
+            if (dist <= potential_sigma) return star_prefactor / (dist*dist);
+            double a = 1./dist + star_decay;
+            return (potential_kernel<STAR>(dist) + potential_shift) * (a*a + 1./(dist*dist));
+        }
+    }
+
+    /* position of a particle slot for the kernels, decoded when COMPACT */
+    template<bool COMPACT>
+    vec3 stored_position(uint32_t q) const {
+        if constexpr (COMPACT) return space.clip(center(&cell_storage[particle_storage[q].cell]) + decode(offsets[q]));
+        else return positions[q];
+    }
+
+    /* compact crystals sum their wigner seitz neighbourhood from the offsets
+     * and the stencil separations, the rest from wrapped positions */
+    template<enum potential_type P, bool WS, bool ORTHO, bool COMPACT>
+    vec3 particle_force_kernel(const particle * self) const {
+        vec3 force;
+        uint32_t s = slot(self);
+        auto add = [&](const vec3 & d) {
+            double dist = d.length();
+            force -= d * (potential_derivative_kernel<P>(dist) / dist);
+        };
+        if constexpr (WS && COMPACT) {
+            vec3 o = decode(offsets[s]);
+            neighbour_cells<true> nn(this, self->cell);
+            for (size_t i = 0; i < nn.size(); i++) {
+                vec3 base = o - nn.delta(i);
+                for (uint32_t q = cell_storage[nn[i]].first; q != particle::none; q = particle_storage[q].next) {
+                    add(stencil_image<ORTHO>(base - decode(offsets[q])));
+                }
+            }
+            for (uint32_t q = cell_storage[self->cell].first; q != particle::none; q = particle_storage[q].next) {
+                if (q != s) add(stencil_image<ORTHO>(o - decode(offsets[q])));
+            }
+        } else if constexpr (WS) {
+            const vec3 & x = positions[s];
+            neighbour_cells<false> nn(this, self->cell);
+            for (size_t i = 0; i < nn.size(); i++) {
+                for (uint32_t q = cell_storage[nn[i]].first; q != particle::none; q = particle_storage[q].next) {
+                    add(space.difference_kernel<ORTHO>(positions[q], x));
+                }
+            }
+            for (uint32_t q = cell_storage[self->cell].first; q != particle::none; q = particle_storage[q].next) {
+                if (q != s) add(space.difference_kernel<ORTHO>(positions[q], x));
+            }
+        } else {
+            vec3 x = stored_position<COMPACT>(s);
+            for (uint32_t q : particles.slots) {
+                if (q != s) add(space.difference_kernel<ORTHO>(stored_position<COMPACT>(q), x));
+            }
+        }
+        return force;
+    }
+
+    template<enum potential_type P, bool WS, bool ORTHO, bool COMPACT, bool BOUNDED>
+    double particle_energy_kernel(const particle * self, vec3 shift, double limit) const {
+        uint32_t s = slot(self);
+        double energy = 0;
+        if constexpr (WS && COMPACT) {
+            vec3 o = trial_offset(self, shift);
+            for (uint32_t q = cell_storage[self->cell].first; q != particle::none; q = particle_storage[q].next) {
+                if (q == s) continue;
+                energy += potential_kernel<P>(stencil_image<ORTHO>(decode(offsets[q]) - o).length());
+            }
+            neighbour_cells<true> nn(this, self->cell);
+            for (size_t i = 0; i < nn.size(); i++) {
+                if constexpr (BOUNDED) if (energy >= limit) return energy;
+                vec3 base = nn.delta(i) - o;
+                for (uint32_t q = cell_storage[nn[i]].first; q != particle::none; q = particle_storage[q].next) {
+                    energy += potential_kernel<P>(stencil_image<ORTHO>(base + decode(offsets[q])).length());
+                }
+            }
+        } else if constexpr (WS) {
+            vec3 image = space.clip_kernel<ORTHO>(positions[s] + shift);
+            for (uint32_t q = cell_storage[self->cell].first; q != particle::none; q = particle_storage[q].next) {
+                if (q == s) continue;
+                energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image, positions[q]));
+            }
+            neighbour_cells<false> nn(this, self->cell);
+            for (size_t i = 0; i < nn.size(); i++) {
+                if constexpr (BOUNDED) if (energy >= limit) return energy;
+                for (uint32_t q = cell_storage[nn[i]].first; q != particle::none; q = particle_storage[q].next) {
+                    energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image, positions[q]));
+                }
+            }
+        } else {
+            vec3 image = COMPACT ? space.clip(center(cell_of(self)) + trial_offset(self, shift))
+                : space.clip_kernel<ORTHO>(positions[s] + shift);
+            for (uint32_t q : particles.slots) {
+                if (q == s) continue;
+                energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image, stored_position<COMPACT>(q)));
+                if constexpr (BOUNDED) if (energy >= limit) return energy;
+            }
+        }
+        return energy;
+    }
+
+    template<enum potential_type P, bool WS, bool ORTHO, bool COMPACT, bool BOUNDED>
+    double two_particle_energy_kernel(const particle * p1, const particle * p2, vec3 sh1, vec3 sh2, double limit) const {
+        uint32_t s1 = slot(p1), s2 = slot(p2);
+        vec3 o1, o2, image1, image2;
+        if constexpr (COMPACT) {
+            o1 = trial_offset(p1, sh1);
+            o2 = trial_offset(p2, sh2);
+            image1 = space.clip(center(cell_of(p1)) + o1);
+            image2 = space.clip(center(cell_of(p2)) + o2);
+        } else {
+            image1 = space.clip_kernel<ORTHO>(positions[s1] + sh1);
+            image2 = space.clip_kernel<ORTHO>(positions[s2] + sh2);
+        }
+        double energy = 2*potential_kernel<P>(space.distance_kernel<ORTHO>(image1, image2));
+        if constexpr (WS) {
+            /* both own cells first, then the neighbour cells closest first */
+            auto own = [&](uint32_t self, uint32_t other, const vec3 & image, const vec3 & o) {
+                for (uint32_t q = cell_storage[particle_storage[self].cell].first; q != particle::none; q = particle_storage[q].next) {
+                    if (q == self || q == other) continue;
+                    if constexpr (COMPACT) energy += potential_kernel<P>(stencil_image<ORTHO>(decode(offsets[q]) - o).length());
+                    else energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image, positions[q]));
+                }
+            };
+            auto neighbours = [&](const neighbour_cells<COMPACT> & nn, size_t i, uint32_t other, const vec3 & image, const vec3 & o) {
+                vec3 base;
+                if constexpr (COMPACT) base = nn.delta(i) - o;
+                for (uint32_t q = cell_storage[nn[i]].first; q != particle::none; q = particle_storage[q].next) {
+                    if (q == other) continue;
+                    if constexpr (COMPACT) energy += potential_kernel<P>(stencil_image<ORTHO>(base + decode(offsets[q])).length());
+                    else energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image, positions[q]));
+                }
+            };
+            own(s1, s2, image1, o1);
+            own(s2, s1, image2, o2);
+            neighbour_cells<COMPACT> nn1(this, p1->cell), nn2(this, p2->cell);
+            for (size_t i = 0; i < std::max(nn1.size(), nn2.size()); i++) {
+                if constexpr (BOUNDED) if (energy >= limit) return energy;
+                if (i < nn1.size()) neighbours(nn1, i, s2, image1, o1);
+                if (i < nn2.size()) neighbours(nn2, i, s1, image2, o2);
+            }
+        } else {
+            for (uint32_t q : particles.slots) {
+                if (q == s1 || q == s2) continue;
+                vec3 x = stored_position<COMPACT>(q);
+                energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image1, x));
+                energy += potential_kernel<P>(space.distance_kernel<ORTHO>(image2, x));
+                if constexpr (BOUNDED) if (energy >= limit) return energy;
+            }
+        }
+        return energy;
+    }
+
+    template<enum potential_type P>
+    void shifted_energies_kernel(const vec3 * r, size_t n, const vec3 * d, size_t k, double * out) const {
+        for (size_t j = 0; j < n; j++) {
+            for (size_t i = 0; i < k; i++) {
+                out[i] += potential_kernel<P>((r[j] - d[i]).length());
+            }
+        }
+    }
+
+    template<enum potential_type P>
+    double scaled_pair_energy_kernel(const vec3 * u, size_t n, const matrix3 & h) const {
+        double energy = 0;
+        for (size_t i = 0; i < n; i++) {
+            energy += potential_kernel<P>((h * u[i]).length());
+        }
+        return energy;
+    }
+
+    template<enum potential_type P, bool WS, bool ORTHO, bool COMPACT>
+    void use_kernels() {
+        particle_energy_impl = &crystal::particle_energy_kernel<P, WS, ORTHO, COMPACT, false>;
+        bounded_particle_energy_impl = &crystal::particle_energy_kernel<P, WS, ORTHO, COMPACT, true>;
+        two_particle_energy_impl = &crystal::two_particle_energy_kernel<P, WS, ORTHO, COMPACT, false>;
+        bounded_two_particle_energy_impl = &crystal::two_particle_energy_kernel<P, WS, ORTHO, COMPACT, true>;
+        particle_force_impl = &crystal::particle_force_kernel<P, WS, ORTHO, COMPACT>;
+    }
+
+    template<enum potential_type P, bool WS, bool COMPACT>
+    void select_geometry() {
+        if (space.orthorhombic()) use_kernels<P, WS, true, COMPACT>();
+        else use_kernels<P, WS, false, COMPACT>();
+    }
+
+    template<enum potential_type P>
+    void select_constraint() {
+        if (!wigner_seitz_constraint) {
+            if (compact) throw "crystal: compact crystals need the wigner seitz constraint, it bounds the offsets";
+            select_geometry<P, false, false>();
+        }
+        else if (compact) select_geometry<P, true, true>();
+        else select_geometry<P, true, false>();
+    }
+
+    bool kernels_selected() const {
+        return particle_energy_impl != nullptr &&
+            kernel_potential_type == potential_type &&
+            kernel_wigner_seitz_constraint == (bool)wigner_seitz_constraint &&
+            kernel_sigma == potential_sigma &&
+            kernel_epsilon == potential_epsilon &&
+            kernel_cutoff == potential_cutoff &&
+            kernel_shift == potential_shift;
+    }
+
+    /* the kernels keep their own copy of the potential, so a change of the
+     * public members without select_kernels() has to fail loudly, in
+     * release builds too */
+    void require_kernels() const {
+        if (!kernels_selected()) throw "crystal: call select_kernels() after configuring the potential";
+    }
+
+    /* the reference engine for validation: the same potential summed over
+     * all particles instead of the wigner seitz neighbourhood */
+    template<enum potential_type P, bool ORTHO>
+    double reference_particle_energy(const particle * self, vec3 shift) const {
+        if (compact) return particle_energy_kernel<P, false, ORTHO, true, false>(self, shift, 0);
+        return particle_energy_kernel<P, false, ORTHO, false, false>(self, shift, 0);
+    }
+    double reference_particle_energy(const particle * self, vec3 shift) const {
+        if (potential_type == HERTZ) {
+            if (space.orthorhombic()) return reference_particle_energy<HERTZ, true>(self, shift);
+            else return reference_particle_energy<HERTZ, false>(self, shift);
+        } else {
+            if (space.orthorhombic()) return reference_particle_energy<STAR, true>(self, shift);
+            else return reference_particle_energy<STAR, false>(self, shift);
+        }
+    }
+    template<enum potential_type P, bool ORTHO>
+    double reference_two_particle_energy(const particle * p1, const particle * p2, vec3 sh1, vec3 sh2) const {
+        if (compact) return two_particle_energy_kernel<P, false, ORTHO, true, false>(p1, p2, sh1, sh2, 0);
+        return two_particle_energy_kernel<P, false, ORTHO, false, false>(p1, p2, sh1, sh2, 0);
+    }
+    double reference_two_particle_energy(const particle * p1, const particle * p2, vec3 sh1, vec3 sh2) const {
+        if (potential_type == HERTZ) {
+            if (space.orthorhombic()) return reference_two_particle_energy<HERTZ, true>(p1, p2, sh1, sh2);
+            else return reference_two_particle_energy<HERTZ, false>(p1, p2, sh1, sh2);
+        } else {
+            if (space.orthorhombic()) return reference_two_particle_energy<STAR, true>(p1, p2, sh1, sh2);
+            else return reference_two_particle_energy<STAR, false>(p1, p2, sh1, sh2);
+        }
+    }
+
+    void log_particle(const char * name, const particle * p, vec3 shift) const {
+        *validation.log << " " << name << " id " << p->id << " cell " << lattice_index(cell_of(p)) << " " << basis(cell_of(p))
+            << " pos " << position(p) << " shift " << shift;
+    }
+
+    /* a sampled cross check of a neighbour sum against the reference engine */
+    void validate(double energy, const particle * p, vec3 shift, const char * what) const {
+        if (!wigner_seitz_constraint || !validation.sample()) return;
+        double reference = reference_particle_energy(p, shift);
+        if (!validation.mismatch(energy, reference)) return;
+        *validation.log << what << " mismatch energy " << energy << " reference " << reference;
+        log_particle("particle", p, shift);
+        *validation.log << "\n";
+        validation.failed();
+    }
+
+    void validate(double energy, const particle * p1, const particle * p2, vec3 sh1, vec3 sh2, const char * what) const {
+        if (!wigner_seitz_constraint || !validation.sample()) return;
+        double reference = reference_two_particle_energy(p1, p2, sh1, sh2);
+        if (!validation.mismatch(energy, reference)) return;
+        *validation.log << what << " mismatch energy " << energy << " reference " << reference;
+        log_particle("p1", p1, sh1);
+        log_particle("p2", p2, sh2);
+        *validation.log << "\n";
+        validation.failed();
+    }
+
+public:
+    /* has to be called after changing the potential or the constraint mode */
+    void select_kernels() {
+        double f = potential_epsilon;
+        star_prefactor = 5./18 * pow(f, 3./2);
+        star_1_1psf2 = 1./(1.+sqrt(f)/2);
+        star_decay = sqrt(f)/(2*potential_sigma);
+        if (potential_type == HERTZ) select_constraint<HERTZ>();
+        else select_constraint<STAR>();
+        kernel_potential_type = potential_type;
+        kernel_wigner_seitz_constraint = wigner_seitz_constraint;
+        kernel_sigma = potential_sigma;
+        kernel_epsilon = potential_epsilon;
+        kernel_cutoff = potential_cutoff;
+        kernel_shift = potential_shift;
+    }
+
     double potential(double dist) const {
         assert(dist != 0);
         assert(dist >= 0);
@@ -70,109 +1010,801 @@ public:
             double sig = potential_sigma;
             double prefactor = 5./18 * pow(f, 3./2);
             double _1_1psf2 = 1./(1.+sqrt(f)/2);
-            if (dist <= sig) {
-                return prefactor * (-std::log(dist/sig) + _1_1psf2);
+            if (dist >= potential_cutoff) {
+                return 0;
+            } else if (dist <= sig) {
+                return prefactor * (-std::log(dist/sig) + _1_1psf2) - potential_shift;
             } else {
-                return prefactor * (sig/dist)*_1_1psf2 * exp(-sqrt(f)/(2*sig)*(dist-sig));
+                return prefactor * (sig/dist)*_1_1psf2 * exp(-sqrt(f)/(2*sig)*(dist-sig)) - potential_shift;
             }
         }
         assert (false);
         return 0;
     }
 
-    static crystal * build(lattice_definition & unitcell, int n1=4, int n2=-1, int n3=-1, double cutoff=2) {
+    struct voronoi_shape {
+        double radius; /* circumradius, the farthest vertex */
+        double face_distance; /* farthest centre sharing a face */
+    };
+
+    /* the voronoi cell around the origin cut by the bisector planes of d,
+     * sorted by length. the planes are taken closest first until the next
+     * one lies beyond twice the radius and cannot cut the cell */
+    static voronoi_shape voronoi_cell(const std::vector<vec3> & d) {
+        std::vector<vec3> vertices;
+        double radius = INFINITY;
+        size_t k;
+        for (k = std::min<size_t>(d.size(), 26);; k = std::min(d.size(), 2 * k)) {
+            vertices.clear();
+            radius = 0;
+            for (size_t i = 0; i < k; i++) {
+                for (size_t j = i + 1; j < k; j++) {
+                    for (size_t l = j + 1; l < k; l++) {
+                        matrix3 m = matrix3::from_rows(d[i], d[j], d[l]);
+                        if (abs(m.det()) < 1e-9 * d[i].length() * d[j].length() * d[l].length()) continue;
+                        vec3 x = m.invert() * vec3(d[i] * d[i] / 2, d[j] * d[j] / 2, d[l] * d[l] / 2);
+                        bool inside = true;
+                        for (size_t n = 0; n < k; n++) {
+                            const vec3 & e = d[n];
+                            if (x * e > e * e / 2 + 1e-9 * (e * e)) { inside = false; break; }
+                        }
+                        if (inside) {
+                            radius = std::max(radius, x.length());
+                            vertices.push_back(x);
+                        }
+                    }
+                }
+            }
+            if (vertices.empty()) radius = INFINITY;
+            if (k == d.size() || (!vertices.empty() && d[k - 1].length() > 2 * radius)) break;
+        }
+        /* a face holds at least three distinct vertices, an edge two */
+        double face_distance = vertices.empty() ? INFINITY : 0;
+        for (size_t i = 0; i < k && !vertices.empty(); i++) {
+            const vec3 & e = d[i];
+            std::vector<vec3> on;
+            for (const vec3 & x : vertices) {
+                if (std::abs(x * e - e * e / 2) > 1e-9 * (e * e)) continue;
+                bool seen = false;
+                for (const vec3 & y : on) seen = seen || (x - y).length() < 1e-9 * e.length();
+                if (!seen) on.push_back(x);
+            }
+            if (on.size() >= 3) face_distance = std::max(face_distance, e.length());
+        }
+        return {radius, face_distance};
+    }
+
+    /* the wigner seitz cells over one cell per basis, from the bisector
+     * planes to all other cells, so they do not depend on the neighbour
+     * lists. contains() does, fit_cutoff() and box_changed() keep every
+     * face neighbour in them */
+    voronoi_shape voronoi() const {
+        voronoi_shape ret = {0, 0};
+        std::vector<int> done;
+        for (const lattice_cell * cell : cells) {
+            if (std::find(done.begin(), done.end(), basis(cell)) != done.end()) continue;
+            done.push_back(basis(cell));
+            std::vector<vec3> d;
+            vec3 c = center(cell);
+            for (const lattice_cell * b : cells) {
+                if (b != cell) d.push_back(space.difference(c, center(b)));
+            }
+            std::stable_sort(d.begin(), d.end(), [](const vec3 & x, const vec3 & y) { return x * x < y * y; });
+            voronoi_shape shape = voronoi_cell(d);
+            ret.radius = std::max(ret.radius, shape.radius);
+            ret.face_distance = std::max(ret.face_distance, shape.face_distance);
+        }
+        return ret;
+    }
+
+    /* circumradius of the wigner seitz cells */
+    double wigner_seitz_radius() const {
+        return voronoi().radius;
+    }
+
+    /* whether the neighbour lists cut out the same wigner seitz cells as
+     * all cells do, within a relative tolerance */
+    bool neighbours_hold_faces(const voronoi_shape & shape, double tolerance=1e-9) const {
+        voronoi_shape lists = {0, 0};
+        std::vector<int> done;
+        for (const lattice_cell * cell : cells) {
+            if (std::find(done.begin(), done.end(), basis(cell)) != done.end()) continue;
+            done.push_back(basis(cell));
+            std::vector<vec3> d;
+            vec3 c = center(cell);
+            for (const lattice_cell * nn : neighbours(cell)) d.push_back(space.difference(c, center(nn)));
+            voronoi_shape cut = voronoi_cell(d);
+            lists.radius = std::max(lists.radius, cut.radius);
+            lists.face_distance = std::max(lists.face_distance, cut.face_distance);
+        }
+        return std::abs(lists.radius - shape.radius) <= tolerance * shape.radius
+            && std::abs(lists.face_distance - shape.face_distance) <= tolerance * shape.face_distance;
+    }
+
+    /* energy per particle of the pairs beyond r that a cutoff at r drops,
+     * in the continuum approximation */
+    double tail_energy(double r) const {
+        if (potential_type == HERTZ) return r >= potential_sigma ? 0 : INFINITY;
+        double f = potential_epsilon;
+        double sig = potential_sigma;
+        double prefactor = 5./18 * pow(f, 3./2);
+        double decay = sqrt(f)/(2*sig);
+        if (r < sig) return INFINITY;
+        /* integral of 4 pi rho s^2 V(s) from r, V = A sig/s exp(-decay (s - sig)) */
+        return 4*M_PI*density() * prefactor*sig/(1.+sqrt(f)/2)
+            * exp(-decay*(r - sig)) * (r/decay + 1/(decay*decay));
+    }
+
+    /* dV/dr and d2V/dr2 of the pair potential, for the harmonic model */
+    double potential_derivative(double dist) const {
+        require_kernels();
+        if (potential_type == HERTZ) return potential_derivative_kernel<HERTZ>(dist);
+        else return potential_derivative_kernel<STAR>(dist);
+    }
+
+    double potential_curvature(double dist) const {
+        require_kernels();
+        if (potential_type == HERTZ) return potential_curvature_kernel<HERTZ>(dist);
+        else return potential_curvature_kernel<STAR>(dist);
+    }
+
+    /* distance beyond which pairs do not interact */
+    double interaction_range() const {
+        return potential_type == HERTZ ? potential_sigma : potential_cutoff;
+    }
+
+    struct cutoff_fit {
+        double cutoff; /* pair interaction range */
+        double shift; /* subtracted from the star potential inside the cutoff */
+        double truncation_error; /* tail_energy(cutoff) */
+        double wigner_seitz_radius;
+        double face_distance; /* farthest cell sharing a wigner seitz face */
+        double displacement_skin;
+        double neighbour_range;
+        double neighbour_cells; /* per cell */
+    };
+    cutoff_fit last_cutoff_fit = {}; /* of the last fit_cutoff(), for the reports */
+
+    /* derives the pair cutoff from the potential and cutoff_tolerance, the
+     * exact sigma for hertz and the tail below the tolerance for star, and
+     * fits the neighbour cell lists to it. has to run again when sigma or
+     * epsilon change, configure_hertz and configure_star do so */
+    cutoff_fit fit_cutoff() {
+        if (!(cutoff_tolerance > 0)) throw "fit_cutoff: cutoff_tolerance has to be positive";
+        cutoff_fit ret;
+        potential_cutoff = INFINITY;
+        potential_shift = 0;
+        if (potential_type == HERTZ) {
+            ret.cutoff = potential_sigma;
+        } else {
+            double lo = potential_sigma, hi = 2*potential_sigma;
+            while (tail_energy(hi) > cutoff_tolerance) hi = lo + 2*(hi - lo);
+            if (tail_energy(lo) <= cutoff_tolerance) hi = lo;
+            while (hi - lo > 1e-6*potential_sigma) {
+                double mid = (lo + hi)/2;
+                if (tail_energy(mid) > cutoff_tolerance) lo = mid;
+                else hi = mid;
+            }
+            ret.cutoff = hi;
+            potential_shift = potential(hi);
+            potential_cutoff = hi;
+        }
+        ret.shift = potential_shift;
+        ret.truncation_error = tail_energy(ret.cutoff);
+        voronoi_shape shape = voronoi();
+        ret.wigner_seitz_radius = maximum_displacement = shape.radius;
+        ret.face_distance = face_distance = shape.face_distance;
+        if (wigner_seitz_constraint) {
+            /* start from the present displacements with some room for thermal motion */
+            double displacement = 0;
+            for (const particle * p : particles) {
+                displacement = std::max(displacement, this->displacement(p));
+            }
+            displacement_skin = std::min(ret.wigner_seitz_radius,
+                    std::max(1.5*displacement, 0.25*ret.wigner_seitz_radius));
+            set_neighbour_range(fitted_neighbour_range());
+            assert(neighbours_hold_faces(shape));
+        } else {
+            displacement_skin = INFINITY;
+        }
+        ret.displacement_skin = displacement_skin;
+        ret.neighbour_range = neighbour_range;
+        check_minimum_image();
+        size_t nn = 0;
+        for (const lattice_cell * cell : cells) nn += neighbours(cell).size();
+        ret.neighbour_cells = (double)nn / cells.size();
+        select_kernels();
+        last_cutoff_fit = ret;
+        return ret;
+    }
+
+    /* the pair cutoff plus twice the skin, and never short of the face
+     * neighbours plus the skin that contains() needs */
+    double fitted_neighbour_range() const {
+        return std::max(interaction_range() + 2*displacement_skin, face_distance + displacement_skin);
+    }
+
+    /* has to be called before a particle of cell is put or evaluated at pos,
+     * grows the skin and the neighbour lists when pos lies beyond it */
+    void cover(const lattice_cell * cell, const vec3 & pos) {
+        if (displacement_skin == INFINITY) return;
+        cover_displacement(space.distance(pos, center(cell)));
+    }
+
+    /* cover() for p moved by shift */
+    void cover(const particle * p, const vec3 & shift) {
+        if (displacement_skin == INFINITY) return;
+        if (!compact) cover_displacement(space.distance(positions[slot(p)] + shift, centers[p->cell]));
+        else cover_displacement(trial_offset(p, shift).length());
+    }
+
+    void cover_displacement(double d) {
+        if (d <= displacement_skin) return;
+        displacement_skin = std::min(std::max(d, 1.5*displacement_skin), maximum_displacement);
+        double range = fitted_neighbour_range();
+        if (range > neighbour_range) find_neighbours(range);
+    }
+
+    /* cover() for every particle where it is now */
+    void cover_all() {
+        for (const particle * p : particles) cover(p, vec3());
+    }
+
+    /* the neighbour cells are picked by the distance of their centres and
+     * the pairs by the distance of the particles, both through the wrapped
+     * minimum image, which a skewed box gets right up to its inscribed
+     * radius only */
+    void check_minimum_image() const {
+        if (wigner_seitz_constraint && !space.orthorhombic() && neighbour_range > space.inscribed_radius()) {
+            throw "crystal: the skewed box is too small for the neighbour range";
+        }
+    }
+
+    /* every pair closer than this lies between neighbouring cells or in one
+     * cell and is measured through the right image, the reach of analyses
+     * that take their pairs from the neighbour lists */
+    double pair_range() const {
+        if (!wigner_seitz_constraint) return space.inscribed_radius();
+        double skin = std::min(displacement_skin, maximum_displacement);
+        if (skin == INFINITY) skin = wigner_seitz_radius();
+        return neighbour_range - 2*skin;
+    }
+
+    /* neighbour lists reaching at least range */
+    void grow_neighbour_range(double range) {
+        if (range > neighbour_range) find_neighbours(range);
+    }
+
+    /* takes the box of space, with the extents of the present one, and
+     * scales the cell centres and particles along; box_changed() has to
+     * follow before the next energy */
+    void scale_box(const periodic_space & space) {
+        periodic_space old = this->space;
+        this->space = space;
+        if (compact) {
+            /* the centres follow the box, the offsets are rescaled in place */
+            matrix3 scale = space.projection() * old.projection().invert();
+            for (uint32_t q : particles.slots) offsets[q] = encode(scale * decode(offsets[q]));
+            return;
+        }
+        for (uint32_t q : particles.slots) positions[q] = space.clip(space.project(old.unproject(positions[q])));
+        for (vec3 & c : centers) c = space.project(old.unproject(c));
+    }
+
+    /* has to be called after the box matrix changed with the cell centres
+     * and particles scaled along: the neighbour lists only hold the cells
+     * within neighbour_range in the old box, and the wigner seitz cells
+     * changed shape. compact crystals quantise the offsets for the new
+     * wigner seitz radius */
+    void box_changed() {
+        voronoi_shape shape = voronoi();
+        maximum_displacement = shape.radius;
+        face_distance = shape.face_distance;
+        if (compact) requantise(maximum_displacement);
+        double range = std::max(neighbour_range, face_distance);
+        if (displacement_skin != INFINITY) {
+            double displacement = 0;
+            for (const particle * p : particles) {
+                displacement = std::max(displacement, this->displacement(p));
+            }
+            displacement_skin = std::min(std::max(displacement_skin, displacement), maximum_displacement);
+            range = fitted_neighbour_range();
+        }
+        find_neighbours(range);
+        assert(!wigner_seitz_constraint || neighbours_hold_faces(shape));
+        check_minimum_image();
+    }
+
+    /* scale_box() and box_changed() in one for a box scaled by s along
+     * every axis. the cells stay similar, so the wigner seitz radius, the
+     * face distance, the skin and the reach of the lists scale along and
+     * the lists are only searched again when the pair cutoff outgrows
+     * them, then headroom farther (relative) so a run of compressions does
+     * not search on every move. compact crystals scale the quantum instead
+     * of the offsets and touch no particle */
+    void scale_box(double s, double headroom=0) {
+        const matrix3 & h = space.projection();
+        space = periodic_space(matrix3::from_cols(h.col1() * s, h.col2() * s, h.col3() * s), space.extents());
+        maximum_displacement *= s;
+        face_distance *= s;
+        neighbour_range *= s;
+        if (displacement_skin != INFINITY) displacement_skin *= s;
+        if (compact) {
+            offset_quantum *= s;
+            for (auto & stencil : stencils) {
+                for (stencil_entry & e : stencil) e.delta = e.delta * s;
+            }
+        } else {
+            for (uint32_t q : particles.slots) positions[q] = space.clip(positions[q] * s);
+            for (vec3 & c : centers) c = c * s;
+        }
+        double range = displacement_skin != INFINITY ? fitted_neighbour_range() : std::max(neighbour_range, face_distance);
+        if (range > neighbour_range) find_neighbours(range * (1 + headroom));
+        else if (neighbour_range > range * (1 + 3*headroom)) set_neighbour_range(range * (1 + headroom));
+        wrap_offsets = compact && neighbour_range + 2*maximum_displacement >= space.inscribed_radius();
+        assert(std::abs(voronoi().radius - maximum_displacement) <= 1e-9 * maximum_displacement);
+        check_minimum_image();
+    }
+
+    /* whether every particle stays in its wigner seitz cell when the box
+     * matrix becomes m times the present one. the positions follow the
+     * box affinely, so an offset x and the separation d of two centres
+     * turn into m x and m d */
+    bool cells_hold_particles(const matrix3 & m) const {
+        if (!wigner_seitz_constraint) return true;
+        std::vector<std::vector<vec3>> separations(lattice_nbasis);
+        std::vector<bool> done(lattice_nbasis, false);
+        for (const lattice_cell * cell : cells) {
+            int b = basis(cell);
+            if (done[b]) continue;
+            done[b] = true;
+            vec3 c = center(cell);
+            for (const lattice_cell * nn : neighbours(cell)) separations[b].push_back(m * space.difference(c, center(nn)));
+        }
+        for (const particle * p : particles) {
+            vec3 x = m * offset(p);
+            double d1 = x * x;
+            for (const vec3 & d : separations[basis(cell_of(p))]) {
+                vec3 y = x - d;
+                if (y * y < d1) return false;
+            }
+        }
+        return true;
+    }
+
+    crystal(const crystal &) = delete;
+    crystal & operator=(const crystal &) = delete;
+
+    particle * allocate_particle() {
+        if (!free_particles.empty()) {
+            particle * p = &particle_storage[free_particles.back()];
+            free_particles.pop_back();
+            *p = particle();
+            p->id = next_particle_id++;
+            return p;
+        }
+        if (particle_storage.size() == particle_storage.capacity()) {
+            throw "particle storage full, reserve_particles() before inserting the defects";
+        }
+        particle_storage.emplace_back();
+        particle_storage.back().id = next_particle_id++;
+        if (compact) offsets.push_back({0, 0, 0});
+        else positions.emplace_back();
+        return &particle_storage.back();
+    }
+
+    /* room for count more interstitials than the free slots hold, init
+     * reserves a quarter of the sites. growing moves the particles in
+     * memory, so like reorder_morton() it invalidates every particle pointer
+     * held outside the crystal, call it before inserting a batch of defects */
+    void reserve_particles(size_t count) {
+        size_t needed = particle_storage.size() + std::max(count, free_particles.size()) - free_particles.size();
+        if (needed <= particle_storage.capacity()) return;
+        if (needed >= particle::none) throw "crystal: more particles than 32 bit slots hold";
+        particle_storage.reserve(needed);
+        if (compact) offsets.reserve(needed);
+        else positions.reserve(needed);
+    }
+
+    /* moves cells and particles in memory so they follow a morton curve of
+     * the lattice index (n1, n2, n3) with the basis innermost, and sweeps
+     * and neighbour loops walk memory mostly sequentially. every particle and
+     * cell pointer held outside the crystal is invalidated, particle::id,
+     * the cell indices and the neighbour order stay, so call this before
+     * setting up measurements */
+    void reorder_morton() {
+        std::vector<uint32_t> order(cell_storage.size());
+        std::vector<uint64_t> keys(cell_storage.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            int i1, i2, i3, basis;
+            lattice_coordinates(cell_keys[i], i1, i2, i3, basis);
+            order[i] = i;
+            keys[i] = morton_key(i1, i2, i3);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            if (keys[a] != keys[b]) return keys[a] < keys[b];
+            return cell_keys[a] % lattice_nbasis < cell_keys[b] % lattice_nbasis;
+        });
+        std::vector<uint32_t> cell_index(cell_storage.size());
+        std::vector<uint32_t> particle_order;
+        particle_order.reserve(particle_storage.size());
+        for (size_t k = 0; k < order.size(); k++) {
+            cell_index[order[k]] = k;
+            for (uint32_t q = cell_storage[order[k]].first; q != particle::none; q = particle_storage[q].next) {
+                particle_order.push_back(q);
+            }
+        }
+        for (uint32_t q : free_particles) particle_order.push_back(q);
+        std::vector<uint32_t> particle_index(particle_storage.size(), particle::none);
+        for (size_t k = 0; k < particle_order.size(); k++) particle_index[particle_order[k]] = k;
+        auto particle_map = [&](uint32_t q) { return q == particle::none ? q : particle_index[q]; };
+        std::vector<particle> new_particles;
+        new_particles.reserve(particle_storage.capacity());
+        for (uint32_t q : particle_order) {
+            particle p = particle_storage[q];
+            if (p.cell != particle::none) p.cell = cell_index[p.cell];
+            p.next = particle_map(p.next);
+            new_particles.push_back(p);
+        }
+        particle_storage.swap(new_particles);
+        if (compact) {
+            std::vector<quantised_offset> moved;
+            moved.reserve(offsets.capacity());
+            for (uint32_t q : particle_order) moved.push_back(offsets[q]);
+            offsets.swap(moved);
+        } else {
+            std::vector<vec3> moved;
+            moved.reserve(positions.capacity());
+            for (uint32_t q : particle_order) moved.push_back(positions[q]);
+            positions.swap(moved);
+            std::vector<vec3> moved_centers;
+            std::vector<std::vector<uint32_t>> moved_lists;
+            moved_centers.reserve(centers.capacity());
+            for (uint32_t c : order) {
+                moved_centers.push_back(centers[c]);
+                moved_lists.push_back(std::move(neighbour_lists[c]));
+                for (uint32_t & nn : moved_lists.back()) nn = cell_index[nn];
+            }
+            centers.swap(moved_centers);
+            neighbour_lists.swap(moved_lists);
+        }
+        std::vector<lattice_cell> new_cells;
+        std::vector<uint32_t> new_keys;
+        new_cells.reserve(cell_storage.capacity());
+        new_keys.reserve(cell_keys.capacity());
+        for (uint32_t c : order) {
+            new_cells.push_back({particle_map(cell_storage[c].first)});
+            new_keys.push_back(cell_keys[c]);
+        }
+        cell_storage.swap(new_cells);
+        cell_keys.swap(new_keys);
+        for (auto & q : free_particles) q = particle_index[q];
+        for (auto & c : lattice_slots) c = cell_index[c];
+        particles.slots.clear();
+        for (uint32_t c = 0; c < cell_storage.size(); c++) {
+            for (uint32_t q = cell_storage[c].first; q != particle::none; q = particle_storage[q].next) {
+                particles.slots.push_back(q);
+            }
+        }
+    }
+
+    /* p has to be removed from particles and its cell already */
+    void release_particle(particle * p) {
+        p->cell = particle::none;
+        free_particles.push_back(slot(p));
+    }
+
+    /* one site of a defect batch: a vacancy removes particle basis of cell,
+     * an interstitial adds a particle at the cell centre + offset and moves
+     * the particles already in the cell back by offset / their number */
+    struct defect_site {
+        lattice_cell * cell;
+        bool interstitial;
+        vec3 offset;
+        int basis;
+        defect_site(lattice_cell * cell, bool interstitial, vec3 offset=vec3(), int basis=0) :
+            cell(cell), interstitial(interstitial), offset(offset), basis(basis) { }
+    };
+
+    /* applies a batch of defects: O(1) work per site, one pass over
+     * particles to drop the removed ones in order, and one cover() for the
+     * farthest moved particle so the neighbour lists are rebuilt at most
+     * once. vacancies go first, so their slots are reused by the
+     * interstitials. returns the new interstitials in site order */
+    std::vector<particle*> insert_defects(const std::vector<defect_site> & sites) {
+        std::vector<particle*> removed;
+        for (const defect_site & site : sites) {
+            if (site.interstitial) continue;
+            uint32_t * link = &site.cell->first;
+            for (int i = 0; i < site.basis && *link != particle::none; i++) link = &particle_storage[*link].next;
+            if (site.basis < 0 || *link == particle::none) throw "insert_defects: no particle to remove";
+            particle * p = &particle_storage[*link];
+            *link = p->next;
+            removed.push_back(p);
+        }
+        if (!removed.empty()) {
+            for (particle * p : removed) p->cell = particle::none;
+            auto & slots = particles.slots;
+            slots.erase(std::remove_if(slots.begin(), slots.end(),
+                        [&](uint32_t q) { return particle_storage[q].cell == particle::none; }), slots.end());
+            for (particle * p : removed) release_particle(p);
+        }
+        std::vector<particle*> ret;
+        double farthest = -1;
+        auto moved = [&](const particle * p) { farthest = std::max(farthest, displacement(p)); };
+        for (const defect_site & site : sites) {
+            if (!site.interstitial) continue;
+            lattice_cell * cell = site.cell;
+            assert(contains(cell, center(cell) + site.offset));
+            size_t count = members(cell).size();
+            if (count) {
+                vec3 shift = site.offset / count;
+                for (particle * p : members(cell)) {
+                    move(p, -shift);
+                    moved(p);
+                }
+            }
+            particle * p = allocate_particle();
+            append(slot(cell), slot(p));
+            place(p, space.clip(center(cell) + site.offset));
+            moved(p);
+            particles.push_back(p);
+            ret.push_back(p);
+        }
+        if (farthest >= 0 && displacement_skin != INFINITY) cover_displacement(farthest);
+        return ret;
+    }
+
+    particle * interstitial(lattice_cell * cell, vec3 offset) {
+        return insert_defects({defect_site(cell, true, offset)})[0];
+    }
+
+    void vacancy(lattice_cell * cell, int basis=0) {
+        insert_defects({defect_site(cell, false, vec3(), basis)});
+    }
+
+    /* count distinct cells drawn uniformly, by a partial fisher-yates shuffle */
+    std::vector<lattice_cell*> random_cells(size_t count, std::mt19937 & rng) const {
+        if (count > cells.size()) throw "random_cells: more cells requested than there are";
+        std::vector<size_t> order(cells.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<lattice_cell*> ret;
+        for (size_t i = 0; i < count; i++) {
+            size_t j = std::uniform_int_distribution<size_t>(i, order.size() - 1)(rng);
+            std::swap(order[i], order[j]);
+            ret.push_back(cells[order[i]]);
+        }
+        return ret;
+    }
+
+    /* raw slot storage, released slots have cell == particle::none. the
+     * positions of plain crystals are per particle slot too, compact ones
+     * only hand out decoded copies */
+    particle * particle_slots() { return particle_storage.data(); }
+    size_t particle_slot_count() const { return particle_storage.size(); }
+    vec3 * position_slots() { return compact ? nullptr : positions.data(); }
+    vec3 * center_slots() { return compact ? nullptr : centers.data(); }
+    lattice_cell * cell_slots() { return cell_storage.data(); }
+    size_t cell_slot_count() const { return cell_storage.size(); }
+    uint32_t particle_slot(const particle * p) const { return slot(p); }
+    uint32_t cell_slot(const lattice_cell * cell) const { return slot(cell); }
+
+    /* deep copy sharing nothing with this crystal, skips the O(N^2) neighbour search */
+    crystal * clone() const {
+        crystal * ret = new crystal(space);
+        ret->potential_type = potential_type;
+        ret->potential_sigma = potential_sigma;
+        ret->potential_epsilon = potential_epsilon;
+        ret->wigner_seitz_constraint = wigner_seitz_constraint;
+        ret->potential_cutoff = potential_cutoff;
+        ret->potential_shift = potential_shift;
+        ret->cutoff_tolerance = cutoff_tolerance;
+        ret->displacement_skin = displacement_skin;
+        ret->maximum_displacement = maximum_displacement;
+        ret->face_distance = face_distance;
+        ret->last_cutoff_fit = last_cutoff_fit;
+        ret->neighbour_range = neighbour_range;
+        ret->validation = validation;
+        ret->compact = compact;
+        ret->lattice_e1 = lattice_e1;
+        ret->lattice_e2 = lattice_e2;
+        ret->lattice_e3 = lattice_e3;
+        ret->lattice_nbasis = lattice_nbasis;
+        ret->cell_keys = cell_keys;
+        ret->lattice_slots = lattice_slots;
+        ret->basis_vectors = basis_vectors;
+        ret->centers = centers;
+        ret->neighbour_lists = neighbour_lists;
+        ret->offset_quantum = offset_quantum;
+        ret->stencils = stencils;
+        /* the particle slots keep their capacity, interstitials fill it */
+        auto copy = [](auto & to, const auto & from) {
+            to.reserve(from.capacity());
+            to.insert(to.end(), from.begin(), from.end());
+        };
+        copy(ret->particle_storage, particle_storage);
+        copy(ret->positions, positions);
+        copy(ret->offsets, offsets);
+        ret->cell_storage = cell_storage;
+        ret->particles.slots = particles.slots;
+        ret->free_particles = free_particles;
+        ret->next_particle_id = next_particle_id;
+        ret->select_kernels();
+        return ret;
+    }
+
+    /* compact keeps quantised offsets, derives the centres and leaves out
+     * the per cell neighbour lists, see offsets and stencils */
+    static crystal * build(lattice_definition & unitcell, int n1=4, int n2=-1, int n3=-1, double cutoff=2,
+            bool compact=false) {
         if (n2 == -1) n2 = n1;
         if (n3 == -1) n3 = n2;
         double a = unitcell.a;
         crystal * ret = new crystal(periodic_space(
             matrix3::from_cols(unitcell.p1(), unitcell.p2(), unitcell.p3()), vec3(n1, n2, n3)));
-        ret->init(n1, n2, n3, a, unitcell, a*cutoff);
+        ret->init(n1, n2, n3, a, unitcell, a*cutoff, compact);
+        ret->select_kernels();
         return ret;
     }
 
+    double particle_energy(const particle * p, vec3 shift=vec3()) const {
+        require_kernels();
+        assert(in_cell(p, vec3()));
+        double energy = (this->*particle_energy_impl)(p, shift, 0);
+        validate(energy, p, shift, "particle_energy");
+        return energy;
+    }
+
     double two_particle_energy(const particle * p1, const particle * p2,
             vec3 sh1=vec3(), vec3 sh2=vec3()) const {
         assert(p1 != p2);
-        double energy_ws = 0;
-#ifdef NDEBUG
-        bool both = false;
-#else
-        bool both = wigner_seitz_constraint;
-#endif
-        if (both || wigner_seitz_constraint) {
-            vec3 image1 = space.clip(p1->pos + sh1);
-            for (const lattice_cell * nn : p1->cell->nearest_neighbours) {
-                for (const particle * p : nn->particles) {
-                    assert(p != p1 && nn != p1->cell);
-                    if (p == p2) continue;
-                    double dist = space.distance(image1, p->pos);
-                    energy_ws += potential(dist);
-                }
-            }
-            if (p1->cell->particles.size() > 1) {
-                for (const particle * p : p1->cell->particles) {
-                    if (p1 == p || p2 == p) continue;
-                    double dist = space.distance(image1, p->pos);
-                    energy_ws += potential(dist);
-                }
-            }
-            vec3 image2 = space.clip(p2->pos + sh2);
-            for (const lattice_cell * nn : p2->cell->nearest_neighbours) {
-                for (const particle * p : nn->particles) {
-                    assert(p != p2 && nn != p2->cell);
-                    if (p == p1) continue;
-                    double dist = space.distance(image2, p->pos);
-                    energy_ws += potential(dist);
-                }
+        require_kernels();
+        double energy = (this->*two_particle_energy_impl)(p1, p2, sh1, sh2, 0);
+        validate(energy, p1, p2, sh1, sh2, "two_particle_energy");
+        return energy;
+    }
+
+    /* particle_energy(), but once the sum reaches limit it may stop and return
+     * any partial sum >= limit, so only results below limit are exact */
+    double bounded_particle_energy(const particle * p, vec3 shift, double limit) const {
+        require_kernels();
+        double energy = (this->*bounded_particle_energy_impl)(p, shift, limit);
+        if (energy < limit) validate(energy, p, shift, "bounded_particle_energy");
+        return energy;
+    }
+
+    double bounded_two_particle_energy(const particle * p1, const particle * p2, vec3 sh1, vec3 sh2, double limit) const {
+        assert(p1 != p2);
+        require_kernels();
+        double energy = (this->*bounded_two_particle_energy_impl)(p1, p2, sh1, sh2, limit);
+        if (energy < limit) validate(energy, p1, p2, sh1, sh2, "bounded_two_particle_energy");
+        return energy;
+    }
+
+    /* separations from self to every particle it interacts with, except
+     * other, for evaluating many trial positions of self on one gather */
+    void gather_separations(const particle * self, const particle * other, std::vector<vec3> & out) const {
+        out.clear();
+        if (compact) {
+            vec3 o = offset(self);
+            auto add = [&](const particle * p, const vec3 & base) {
+                if (p == self || p == other) return;
+                vec3 d = base + decode(offsets[slot(p)]);
+                out.push_back(wrap_offsets ? space.difference(vec3(), d) : d);
+            };
+            for (const particle * p : members(cell_of(self))) add(p, -o);
+            neighbour_cells<true> nn(this, self->cell);
+            for (size_t i = 0; i < nn.size(); i++) {
+                for (const particle * p : members(&cell_storage[nn[i]])) add(p, nn.delta(i) - o);
             }
-            if (p2->cell->particles.size() > 1) {
-                for (const particle * p : p2->cell->particles) {
-                    if (p2 == p || p1 == p) continue;
-                    double dist = space.distance(image2, p->pos);
-                    energy_ws += potential(dist);
-                }
+            return;
+        }
+        auto add = [&](const particle * p) {
+            if (p != self && p != other) out.push_back(space.difference(positions[slot(self)], positions[slot(p)]));
+        };
+        if (wigner_seitz_constraint) {
+            for (const particle * p : members(cell_of(self))) add(p);
+            for (const lattice_cell * nn : neighbours(cell_of(self))) {
+                for (const particle * p : members(nn)) add(p);
             }
-            energy_ws += 2*potential(space.distance(image1, image2));
-#ifdef NDEBUG
-            return energy_ws;
-#endif
+        } else {
+            for (const particle * p : particles) add(p);
         }
-        double energy_all = 0;
-        if (both || !wigner_seitz_constraint) {
-            vec3 image1 = space.clip(p1->pos + sh1);
-            vec3 image2 = space.clip(p2->pos + sh2);
-            for (const particle * p : particles) {
-                if (p == p1 || p == p2) continue;
-                double dist1 = space.distance(image1, p->pos);
-                energy_all += potential(dist1);
-                double dist2 = space.distance(image2, p->pos);
-                energy_all += potential(dist2);
-            }
-            energy_all += 2*potential(space.distance(image1, image2));
-#ifdef NDEBUG
-            return energy_all;
-#endif
+    }
+
+    /* out[i] += sum_j V(|r_j - d_i|) for k shifts d_i of a particle with the
+     * gathered separations r, in one pass over r. the minimum image is that of
+     * the gather, so shifts have to be small against the box */
+    void shifted_energies(const std::vector<vec3> & r, const vec3 * d, size_t k, double * out) const {
+        require_kernels();
+        if (potential_type == HERTZ) shifted_energies_kernel<HERTZ>(r.data(), r.size(), d, k, out);
+        else shifted_energies_kernel<STAR>(r.data(), r.size(), d, k, out);
+    }
+
+    /* sum of V(|h u|) over scaled pair separations u, used for box moves */
+    double scaled_pair_energy(const vec3 * u, size_t n, const matrix3 & h) const {
+        require_kernels();
+        if (potential_type == HERTZ) return scaled_pair_energy_kernel<HERTZ>(u, n, h);
+        else return scaled_pair_energy_kernel<STAR>(u, n, h);
+    }
+
+    /* -dE/dpos over the same neighbours as particle_energy() */
+    vec3 particle_force(const particle * p) const {
+        require_kernels();
+        return (this->*particle_force_impl)(p);
+    }
+
+    double total_energy() const {
+        double energy = 0;
+        for (const particle * p : particles) {
+            energy += particle_energy(p);
+        }
+        return energy / 2;
+    }
+
+    /* full energy audit: every particle's neighbour sum against the all
+     * pairs reference, O(N^2), and with the constraint every particle
+     * inside its cell. logs each mismatching particle and the two totals,
+     * returns the number of mismatches */
+    int audit(int64_t sweep=-1) const {
+        require_kernels();
+        validation.audits += 1;
+        int count = 0;
+        double total = 0, reference_total = 0;
+        for (const particle * p : particles) {
+            if (wigner_seitz_constraint && !in_cell(p, vec3())) {
+                *validation.log << "audit sweep " << sweep << " outside its cell";
+                log_particle("particle", p, vec3());
+                *validation.log << "\n";
+                count += 1;
+            }
+            double energy = (this->*particle_energy_impl)(p, vec3(), 0);
+            double reference = reference_particle_energy(p, vec3());
+            total += energy / 2;
+            reference_total += reference / 2;
+            if (!validation.mismatch(energy, reference)) continue;
+            *validation.log << "audit sweep " << sweep << " mismatch energy " << energy << " reference " << reference;
+            log_particle("particle", p, vec3());
+            *validation.log << "\n";
+            count += 1;
         }
-        if (both && !(abs(energy_ws - energy_all) < 1e-3)) {
-            std::cout << "two_particle_energy() mismatch\n";
-            PRINT_VAR(p1->cell->nb);
-            PRINT_VAR(p2->cell->nb);
-            PRINT_VAR(energy_ws);
-            PRINT_VAR(energy_all);
+        if (count) {
+            *validation.log << "audit sweep " << sweep << " total " << total << " reference " << reference_total
+                << " mismatches " << count << "\n";
+            validation.failed();
         }
-        assert(!both || abs(energy_ws - energy_all) < 1e-3);
-        return energy_all;
+        return count;
     }
 
     /* boring functions */
 
     lattice_cell * get_cell(int n1, int n2, int n3, int n4) {
-        vec3 n(n1, n2, n3);
-        for (lattice_cell * cell : cells) {
-            if (cell->n == n && cell->basis == n4) {
-                return cell; }
+        if (n1 < 0 || n1 >= lattice_e1 || n2 < 0 || n2 >= lattice_e2 || n3 < 0 || n3 >= lattice_e3
+                || n4 < 0 || n4 >= lattice_nbasis) {
+            throw "cell not found";
+        }
+        return &cell_storage[lattice_slots[lattice_key(n1, n2, n3, n4)]];
+    }
+
+    /* wigner seitz constraint: no neighbour centre closer to pos */
+    bool contains(const lattice_cell * cell, const vec3 & pos) const {
+        if (!wigner_seitz_constraint) return true;
+        if (compact) return inside(cell, space.difference(center(cell), pos));
+        auto d1 = space.distance(centers[slot(cell)], pos);
+        for (uint32_t nn : neighbour_lists[slot(cell)]) {
+            auto d2 = space.distance(centers[nn], pos);
+            if (d2 < d1) {
+                return false;
+            }
         }
-        throw "cell not found";
+        return true;
+    }
+
+    /* contains() for p moved by shift */
+    bool in_cell(const particle * p, const vec3 & shift) const {
+        if (!wigner_seitz_constraint) return true;
+        if (compact) return inside(cell_of(p), trial_offset(p, shift));
+        return contains(cell_of(p), positions[slot(p)] + shift);
     }
 
     double density() const {
@@ -195,9 +1827,10 @@ public:
         out << p2.x << " " << p2.y << " " << p2.z << "\n";
         out << p3.x << " " << p3.y << " " << p3.z << "\n";
         for (const particle * p: particles) {
-            out << p->pos.x << " "
-                << p->pos.y << " "
-                << p->pos.z << " "
+            vec3 pos = position(p);
+            out << pos.x << " "
+                << pos.y << " "
+                << pos.z << " "
                 << p->size << " "
                 << p->color << " "
                 << "\n"; 
@@ -207,17 +1840,18 @@ public:
 
     void log(int iter, std::ostream & out) const {
         for (const particle * p: particles) {
+            vec3 pos = position(p), c = center(cell_of(p)), n = lattice_index(cell_of(p));
             out << iter << " "
-                << p->pos.x << " "
-                << p->pos.y << " "
-                << p->pos.z << " "
-                << p->cell->center.x << " "
-                << p->cell->center.y << " "
-                << p->cell->center.z << " "
-                << p->cell->n.x << " "
-                << p->cell->n.y << " "
-                << p->cell->n.z << " "
-                << p->cell->basis << " "
+                << pos.x << " "
+                << pos.y << " "
+                << pos.z << " "
+                << c.x << " "
+                << c.y << " "
+                << c.z << " "
+                << n.x << " "
+                << n.y << " "
+                << n.z << " "
+                << basis(cell_of(p)) << " "
                 << "\n"; 
         }
         out << std::flush;
@@ -225,94 +1859,4 @@ public:
 
 };
 
-// stupid c++
-
-particle * lattice_cell::interstitial(vec3 offset) {
-    assert(contains(center + offset));
-    for (const particle * p : particles) {
-        contains(p->pos - offset / particles.size());
-    }
-    for (particle * p : particles) {
-        p->pos = owner->space.clip(p->pos - offset / particles.size());
-    }
-    particle * p = new particle();
-    p->pos = owner->space.clip(center + offset);
-    p->cell = this;
-    p->owner = owner;
-    owner->particles.push_back(p);
-    particles.push_back(p);
-    return p;
-}
-
-void lattice_cell::vacancy(int basis) {
-    assert((int)particles.size() >= basis);
-    particle * p = particles[basis];
-    for (auto it = owner->particles.begin(); it != owner->particles.end();) {
-        if ((*it) == p) {
-            it = owner->particles.erase(it);
-        } else {
-            ++it;
-        }
-    }
-    particles.erase(particles.begin() + basis);
-}
-
-double particle::energy(vec3 shift) {
-#ifdef NDEBUG
-        bool both = false;
-#else
-        bool both = owner->wigner_seitz_constraint;
-#endif
-    assert(cell->contains(pos));
-    double energy_ws = 0;
-    if (both || owner->wigner_seitz_constraint) {
-        for (const lattice_cell * nn : cell->nearest_neighbours) {
-            vec3 image = owner->space.clip(pos + shift);
-            for (const particle * p : nn->particles) {
-                assert(p != this);
-                double dist = owner->space.distance(image, p->pos);
-                energy_ws += owner->potential(dist);
-            }
-        }
-        if (cell->particles.size() > 1) {
-            vec3 image = owner->space.clip(pos + shift);
-            for (const particle * p : cell->particles) {
-                if (p == this) continue;
-                double dist = owner->space.distance(image, p->pos);
-                energy_ws += owner->potential(dist);
-            }
-        }
-#ifdef NDEBUG
-        return energy_ws;
-#endif
-    }
-    double energy_all = 0;
-    if (both || !owner->wigner_seitz_constraint) {
-        vec3 image = owner->space.clip(pos + shift);
-        for (const particle * p : owner->particles) {
-            if (p == this) continue;
-            double dist = owner->space.distance(image, p->pos);
-            energy_all += owner->potential(dist);
-        }
-#ifdef NDEBUG
-        return energy_all;
-#endif
-    }
-    assert(!both || energy_ws == energy_all);
-    return energy_all;
-}
-
-bool lattice_cell::contains(const vec3 & pos) const {
-    /* wigner seitz constraint */
-    if (!owner->wigner_seitz_constraint) return true;
-    auto d1 = owner->space.distance(center, pos);
-    for (const lattice_cell * nn : nearest_neighbours) {
-        auto d2 = owner->space.distance(nn->center, pos);
-        if (d2 < d1) {
-            return false;
-        }
-    }
-    return true;
-}
-
 #endif
@@ -0,0 +1,209 @@
+#ifndef DISPLACEMENT_FIELD_HPP
+#define DISPLACEMENT_FIELD_HPP
+
+#include <array>
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "crystal.hpp"
+#include "fft.hpp"
+#include "parallel.hpp"
+
+class displacement_field {
+    /* the displacement u of every lattice site (n1, n2, n3, basis), the
+     * mean offset of the particles in its cell from the cell centre (0 for
+     * an empty cell), and the strain eps_ij = (du_i/dx_j + du_j/dx_i) / 2
+     * from central differences to the neighbouring sites of the same basis,
+     * dn turned into dx with the unit cell matrix. both are averaged over
+     * the samples; every sample also goes through a forward fft over
+     * (n1, n2, n3) per component and basis to accumulate the displacement
+     * power <|u(q)|^2>. the transforms of the mean fields are taken once
+     * when written, which is the same as averaging the per sample ones */
+    crystal * crystalp;
+    const lattice_cell * origin;
+    size_t e1, e2, e3, nbasis;
+    std::vector<const lattice_cell*> grid; /* ((i1 e2 + i2) e3 + i3) nbasis + basis */
+    double to_index[3][3]; /* dn_k/dx_j, the inverse unit cell matrix */
+
+    size_t sites() const {
+        return grid.size();
+    }
+
+    size_t index(long i1, long i2, long i3, size_t basis) const {
+        i1 = (i1 % (long)e1 + (long)e1) % (long)e1;
+        i2 = (i2 % (long)e2 + (long)e2) % (long)e2;
+        i3 = (i3 % (long)e3 + (long)e3) % (long)e3;
+        return ((i1 * e2 + i2) * e3 + i3) * nbasis + basis;
+    }
+
+    /* symmetric gradient of a site field, xx yy zz yz xz xy */
+    void strain(const std::vector<vec3> & u, std::vector<std::array<double, 6>> & eps) const {
+        eps.resize(sites());
+        for (long i1 = 0; i1 < (long)e1; i1++) {
+            for (long i2 = 0; i2 < (long)e2; i2++) {
+                for (long i3 = 0; i3 < (long)e3; i3++) {
+                    for (size_t b = 0; b < nbasis; b++) {
+                        vec3 dn[3] = {
+                            (u[index(i1 + 1, i2, i3, b)] - u[index(i1 - 1, i2, i3, b)]) / 2,
+                            (u[index(i1, i2 + 1, i3, b)] - u[index(i1, i2 - 1, i3, b)]) / 2,
+                            (u[index(i1, i2, i3 + 1, b)] - u[index(i1, i2, i3 - 1, b)]) / 2};
+                        double g[3][3];
+                        for (int i = 0; i < 3; i++) {
+                            for (int j = 0; j < 3; j++) {
+                                g[i][j] = 0;
+                                for (int k = 0; k < 3; k++) {
+                                    double du = i == 0 ? dn[k].x : i == 1 ? dn[k].y : dn[k].z;
+                                    g[i][j] += du * to_index[k][j];
+                                }
+                            }
+                        }
+                        eps[index(i1, i2, i3, b)] = {g[0][0], g[1][1], g[2][2],
+                            (g[1][2] + g[2][1]) / 2, (g[0][2] + g[2][0]) / 2, (g[0][1] + g[1][0]) / 2};
+                    }
+                }
+            }
+        }
+    }
+
+    /* forward fft of one component of one basis of a site field */
+    template<typename Component>
+    std::vector<std::complex<double>> transform(size_t b, Component component) const {
+        std::vector<std::complex<double>> ret(e1 * e2 * e3);
+        for (size_t i = 0; i < ret.size(); i++) ret[i] = component(i * nbasis + b);
+        fft3(ret.data(), e1, e2, e3);
+        return ret;
+    }
+
+public:
+    unsigned nthreads;
+    int64_t nsamples = 0;
+    std::vector<double> occupancy; /* particles per site summed over samples */
+    std::vector<vec3> displacement; /* summed over samples */
+    std::vector<std::array<double, 6>> strains; /* summed over samples */
+    std::vector<std::array<double, 3>> power; /* |u(q)|^2 per site slot of the q grid, summed */
+
+    /* origin is only passed on to the file, the defect cell for instance */
+    displacement_field(crystal * crystalp, const lattice_cell * origin=nullptr, unsigned nthreads=0) :
+        crystalp(crystalp), origin(origin), nthreads(nthreads) {
+        vec3 extents = crystalp->space.extents();
+        e1 = lround(extents.x);
+        e2 = lround(extents.y);
+        e3 = lround(extents.z);
+        nbasis = 0;
+        for (const lattice_cell * cell : crystalp->cells) nbasis = std::max<size_t>(nbasis, crystalp->basis(cell) + 1);
+        grid.assign(e1 * e2 * e3 * nbasis, nullptr);
+        for (const lattice_cell * cell : crystalp->cells) {
+            vec3 n = crystalp->lattice_index(cell);
+            grid.at(index(lround(n.x), lround(n.y), lround(n.z), crystalp->basis(cell))) = cell;
+        }
+        for (const lattice_cell * cell : grid) {
+            if (!cell) throw "displacement_field: cells do not fill the lattice grid";
+        }
+        for (int j = 0; j < 3; j++) {
+            vec3 column = crystalp->space.unproject(vec3(j == 0, j == 1, j == 2));
+            to_index[0][j] = column.x;
+            to_index[1][j] = column.y;
+            to_index[2][j] = column.z;
+        }
+        occupancy.assign(sites(), 0);
+        displacement.assign(sites(), vec3());
+        strains.assign(sites(), {0, 0, 0, 0, 0, 0});
+        power.assign(sites(), {0, 0, 0});
+    }
+
+    void measure() {
+        std::vector<vec3> u(sites());
+        for (size_t i = 0; i < sites(); i++) {
+            auto members = crystalp->members(grid[i]);
+            size_t count = members.size();
+            for (const particle * p : members) u[i] += crystalp->offset(p) / count;
+            occupancy[i] += count;
+            displacement[i] += u[i];
+        }
+        std::vector<std::array<double, 6>> eps;
+        strain(u, eps);
+        for (size_t i = 0; i < sites(); i++) {
+            for (int c = 0; c < 6; c++) strains[i][c] += eps[i][c];
+        }
+        parallel_for(3 * nbasis, nthreads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t job = begin; job < end; job++) {
+                size_t b = job / 3, c = job % 3;
+                auto uq = transform(b, [&](size_t i) { return c == 0 ? u[i].x : c == 1 ? u[i].y : u[i].z; });
+                for (size_t h = 0; h < uq.size(); h++) power[h * nbasis + b][c] += std::norm(uq[h]);
+            }
+        });
+        nsamples += 1;
+    }
+
+    /* binary: char[8] "SSFIELD1", int32 e1, e2, e3, nbasis, int64 nsamples,
+     * int32 origin n1, n2, n3, basis (-1 for none), then per site in
+     * ((n1 e2 + n2) e3 + n3) nbasis + basis order 13 doubles: centre x y z,
+     * mean occupancy, mean u x y z, mean strain xx yy zz yz xz xy, then per
+     * q slot in the same order 24 doubles: q x y z (2 pi P^-T h/e with h
+     * folded into [-e/2, e/2)), the transform sum_n f(n) exp(-2 pi i h.n/e)
+     * of the mean u x y z and of the mean strain as re im pairs, and the
+     * mean |u(q)|^2 x y z */
+    void write(const std::string & filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        out.write("SSFIELD1", 8);
+        int32_t header[4] = {(int32_t)e1, (int32_t)e2, (int32_t)e3, (int32_t)nbasis};
+        out.write((const char*)header, sizeof(header));
+        out.write((const char*)&nsamples, sizeof(nsamples));
+        int32_t at[4] = {-1, -1, -1, -1};
+        if (origin) {
+            vec3 n = crystalp->lattice_index(origin);
+            at[0] = lround(n.x);
+            at[1] = lround(n.y);
+            at[2] = lround(n.z);
+            at[3] = crystalp->basis(origin);
+        }
+        out.write((const char*)at, sizeof(at));
+        double scale = nsamples ? 1. / nsamples : 0;
+        for (size_t i = 0; i < sites(); i++) {
+            vec3 c = crystalp->center(grid[i]), u = displacement[i] * scale;
+            double record[13] = {c.x, c.y, c.z, occupancy[i] * scale, u.x, u.y, u.z};
+            for (int k = 0; k < 6; k++) record[7 + k] = strains[i][k] * scale;
+            out.write((const char*)record, sizeof(record));
+        }
+        /* [basis][component] transforms of the mean fields */
+        std::vector<std::vector<std::complex<double>>> uq, epsq;
+        for (size_t b = 0; b < nbasis; b++) {
+            uq.push_back(transform(b, [&](size_t i) { return displacement[i].x * scale; }));
+            uq.push_back(transform(b, [&](size_t i) { return displacement[i].y * scale; }));
+            uq.push_back(transform(b, [&](size_t i) { return displacement[i].z * scale; }));
+            for (int k = 0; k < 6; k++) epsq.push_back(transform(b, [&](size_t i) { return strains[i][k] * scale; }));
+        }
+        for (size_t h1 = 0; h1 < e1; h1++) {
+            for (size_t h2 = 0; h2 < e2; h2++) {
+                for (size_t h3 = 0; h3 < e3; h3++) {
+                    double f[3] = {
+                        (2 * h1 < e1 ? (double)h1 : (double)h1 - e1) / e1,
+                        (2 * h2 < e2 ? (double)h2 : (double)h2 - e2) / e2,
+                        (2 * h3 < e3 ? (double)h3 : (double)h3 - e3) / e3};
+                    double q[3];
+                    for (int j = 0; j < 3; j++) {
+                        q[j] = 2 * M_PI * (to_index[0][j] * f[0] + to_index[1][j] * f[1] + to_index[2][j] * f[2]);
+                    }
+                    size_t h = (h1 * e2 + h2) * e3 + h3;
+                    for (size_t b = 0; b < nbasis; b++) {
+                        double record[24] = {q[0], q[1], q[2]};
+                        for (int c = 0; c < 3; c++) {
+                            record[3 + 2 * c] = uq[3 * b + c][h].real();
+                            record[4 + 2 * c] = uq[3 * b + c][h].imag();
+                        }
+                        for (int k = 0; k < 6; k++) {
+                            record[9 + 2 * k] = epsq[6 * b + k][h].real();
+                            record[10 + 2 * k] = epsq[6 * b + k][h].imag();
+                        }
+                        for (int c = 0; c < 3; c++) record[21 + c] = power[h * nbasis + b][c] * scale;
+                        out.write((const char*)record, sizeof(record));
+                    }
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef ENERGY_VALIDATION_HPP
+#define ENERGY_VALIDATION_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+class energy_validation {
+    /* picks the energy evaluations that get cross checked against the all
+     * pairs reference and keeps the tally. the gaps between checks are
+     * geometric, so a random fraction of evaluations is checked and an
+     * unchecked one costs a decrement. the random stream is its own, runs
+     * follow the same trajectory whatever the fraction */
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    int64_t gap = 0;
+
+    /* splitmix64, uniform in (0, 1] */
+    double uniform() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z = z ^ (z >> 31);
+        return ((z >> 11) + 1) * 0x1.0p-53;
+    }
+
+    void draw_gap() {
+        if (fraction >= 1) gap = 0;
+        else gap = (int64_t)std::floor(std::log(uniform()) / std::log1p(-fraction));
+    }
+
+public:
+    /* of the energy evaluations cross checked, debug builds check a few
+     * percent instead of every one, release builds a few in ten thousand
+     * and only log mismatches. 0 turns the checks off */
+#ifdef NDEBUG
+    double fraction = 1e-4;
+#else
+    double fraction = 0.02;
+#endif
+    double tolerance = 1e-3; /* absolute */
+    int audit_every = 0; /* sweeps between full energy audits, 0 for none */
+#ifdef NDEBUG
+    bool abort_on_mismatch = false;
+#else
+    bool abort_on_mismatch = true;
+#endif
+    std::ostream * log = &std::cerr;
+
+    uint64_t checks = 0;
+    uint64_t audits = 0;
+    uint64_t mismatches = 0;
+    double worst = 0; /* largest difference seen */
+
+    void seed(uint64_t seed) {
+        state = seed ^ 0x9e3779b97f4a7c15ull;
+        gap = 0;
+        draw_gap();
+    }
+
+    /* whether to check this evaluation */
+    bool sample() {
+        if (!(fraction > 0)) return false;
+        if (gap > 0) {
+            gap -= 1;
+            return false;
+        }
+        draw_gap();
+        return true;
+    }
+
+    /* tallies one comparison, true when it failed and the caller should log
+     * its context to *log and then call failed() */
+    bool mismatch(double energy, double reference) {
+        checks += 1;
+        double difference = std::abs(energy - reference);
+        if (difference > worst || difference != difference) worst = difference;
+        if (difference < tolerance) return false;
+        mismatches += 1;
+        return true;
+    }
+
+    void failed() {
+        log->flush();
+        if (abort_on_mismatch) throw "energy_validation: neighbour sum differs from the all pairs reference";
+    }
+
+    void write(std::ostream & out) const {
+        out << "fraction " << fraction << "\n"
+            << "tolerance " << tolerance << "\n"
+            << "audit_every " << audit_every << "\n"
+            << "checks " << checks << "\n"
+            << "audits " << audits << "\n"
+            << "mismatches " << mismatches << "\n"
+            << "worst " << worst << "\n";
+    }
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+/* mixed radix cooley tukey for any length: split by the smallest prime
+ * factor p, transform the p decimated sequences and combine them with a
+ * length p dft, O(n sum of the prime factors). sign -1 is the forward
+ * transform X_k = sum_j x_j exp(-2 pi i jk/n), unnormalised both ways */
+inline void fft_recursive(const std::complex<double> * in, size_t stride, std::complex<double> * out, size_t n,
+        int sign, std::complex<double> * scratch) {
+    if (n == 1) {
+        out[0] = in[0];
+        return;
+    }
+    size_t p = 2;
+    while (n % p != 0 && p * p <= n) p += 1;
+    if (n % p != 0) p = n;
+    size_t m = n / p;
+    for (size_t r = 0; r < p; r++) fft_recursive(in + r * stride, stride * p, out + r * m, m, sign, scratch);
+    /* X_{k + ms} = sum_r exp(sign 2 pi i r(k + ms)/n) Y_r(k), in place per k
+     * since {rm + k} and {k + ms} are the same slots */
+    for (size_t k = 0; k < m; k++) {
+        for (size_t r = 0; r < p; r++) out[r * m + k] *= std::polar(1., sign * 2 * M_PI * r * k / n);
+        for (size_t s = 0; s < p; s++) {
+            std::complex<double> sum = 0;
+            for (size_t r = 0; r < p; r++) sum += out[r * m + k] * std::polar(1., sign * 2 * M_PI * (r * s % p) / p);
+            scratch[s] = sum;
+        }
+        for (size_t s = 0; s < p; s++) out[k + m * s] = scratch[s];
+    }
+}
+
+/* in place along one axis of a row major grid, every line of length n
+ * with the given element stride */
+inline void fft_axis(std::complex<double> * data, size_t n, size_t stride, size_t lines, size_t line_stride_outer,
+        size_t inner, int sign) {
+    std::vector<std::complex<double>> line(n), out(n), scratch(n);
+    for (size_t a = 0; a < lines; a++) {
+        for (size_t b = 0; b < inner; b++) {
+            std::complex<double> * start = data + a * line_stride_outer + b;
+            for (size_t j = 0; j < n; j++) line[j] = start[j * stride];
+            fft_recursive(line.data(), 1, out.data(), n, sign, scratch.data());
+            for (size_t j = 0; j < n; j++) start[j * stride] = out[j];
+        }
+    }
+}
+
+/* 3d transform of a row major e1 x e2 x e3 grid */
+inline void fft3(std::complex<double> * data, size_t e1, size_t e2, size_t e3, int sign=-1) {
+    fft_axis(data, e3, 1, e1 * e2, e3, 1, sign);
+    fft_axis(data, e2, e3, e1, e2 * e3, e3, sign);
+    fft_axis(data, e1, e2 * e3, 1, 0, e2 * e3, sign);
+}
+
+#endif
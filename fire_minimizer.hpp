@@ -0,0 +1,106 @@
+#ifndef FIRE_MINIMIZER_HPP
+#define FIRE_MINIMIZER_HPP
+
+#include <vector>
+
+#include "crystal.hpp"
+
+class fire_minimizer {
+    /* FIRE, Bitzek et al. Phys. Rev. Lett. 97, 170201 (2006), unit masses.
+     * works on the crystal in place so the result can be used as the
+     * starting configuration of a monte carlo run */
+    crystal * crystalp;
+    std::vector<vec3> velocity;
+    std::vector<vec3> force;
+public:
+    double dt = 0.01;
+    double dt_max = 0.1;
+    double alpha_start = 0.1;
+    double f_inc = 1.1;
+    double f_dec = 0.5;
+    double f_alpha = 0.99;
+    int n_min = 5;
+    double max_step = 0.1; /* largest displacement of a particle per iteration */
+
+    struct result {
+        int iterations;
+        double energy;
+        double residual_force; /* largest force on a single particle */
+        int wall_hits; /* steps blocked by the wigner seitz constraint */
+        bool converged;
+    };
+
+    fire_minimizer(crystal * crystalp) : crystalp(crystalp) { }
+
+    double residual_force() {
+        double fmax = 0;
+        for (const particle * p : crystalp->particles) {
+            fmax = std::max(fmax, crystalp->particle_force(p).length());
+        }
+        return fmax;
+    }
+
+    result minimize(double force_tolerance=1e-6, int max_iterations=10000) {
+        auto & particles = crystalp->particles;
+        size_t n = particles.size();
+        velocity.assign(n, vec3());
+        force.resize(n);
+        double timestep = dt;
+        double alpha = alpha_start;
+        int npositive = 0;
+        result ret = {0, 0, 0, 0, false};
+        for (ret.iterations = 0; ret.iterations < max_iterations; ret.iterations++) {
+            double fmax = 0;
+            double power = 0;
+            for (size_t i = 0; i < n; i++) {
+                force[i] = crystalp->particle_force(particles[i]);
+                fmax = std::max(fmax, force[i].length());
+                power += force[i] * velocity[i];
+            }
+            ret.residual_force = fmax;
+            if (fmax < force_tolerance) {
+                ret.converged = true;
+                break;
+            }
+            if (power > 0) {
+                npositive += 1;
+                if (npositive > n_min) {
+                    timestep = std::min(timestep * f_inc, dt_max);
+                    alpha *= f_alpha;
+                }
+            } else {
+                npositive = 0;
+                timestep *= f_dec;
+                alpha = alpha_start;
+                for (auto & v : velocity) v = vec3();
+            }
+            double vnorm2 = 0;
+            double fnorm2 = 0;
+            for (size_t i = 0; i < n; i++) {
+                velocity[i] += timestep * force[i];
+                vnorm2 += velocity[i] * velocity[i];
+                fnorm2 += force[i] * force[i];
+            }
+            double mix = fnorm2 > 0 ? alpha * sqrt(vnorm2 / fnorm2) : 0;
+            for (size_t i = 0; i < n; i++) {
+                velocity[i] = (1 - alpha) * velocity[i] + mix * force[i];
+                vec3 step = timestep * velocity[i];
+                double length = step.length();
+                if (length > max_step) step = step * (max_step / length);
+                particle * p = particles[i];
+                if (!crystalp->in_cell(p, step)) {
+                    /* the wall stops the particle */
+                    velocity[i] = vec3();
+                    ret.wall_hits += 1;
+                    continue;
+                }
+                crystalp->cover(p, step);
+                crystalp->move(p, step);
+            }
+        }
+        ret.energy = crystalp->total_energy();
+        return ret;
+    }
+};
+
+#endif
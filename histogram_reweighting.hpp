@@ -0,0 +1,291 @@
+#ifndef HISTOGRAM_REWEIGHTING_HPP
+#define HISTOGRAM_REWEIGHTING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* joint samples of the total energy and a few observables from one
+ * canonical run at fixed beta, in the order they were taken */
+struct histogram_run {
+    double kbt = 0; /* as set by the scenario, beta * kbt converts between the two */
+    double beta = 0;
+    std::vector<double> energies;
+    std::vector<std::vector<double>> observables; /* [sample][observable] */
+
+    void add(double energy, const std::vector<double> & values) {
+        if (!observables.empty() && values.size() != observables[0].size()) throw "histogram_run: observable count changed";
+        energies.push_back(energy);
+        observables.push_back(values);
+    }
+
+    size_t size() const {
+        return energies.size();
+    }
+
+    /* binary: char[8] "SSHIST01", double kbt, beta, int64 samples, int64 observables,
+     * then per sample double energy, observables */
+    void write(const std::string & filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        out.write("SSHIST01", 8);
+        int64_t n = size(), k = observables.empty() ? 0 : observables[0].size();
+        out.write((const char*)&kbt, sizeof(double));
+        out.write((const char*)&beta, sizeof(double));
+        out.write((const char*)&n, sizeof(n));
+        out.write((const char*)&k, sizeof(k));
+        for (size_t i = 0; i < size(); i++) {
+            out.write((const char*)&energies[i], sizeof(double));
+            out.write((const char*)observables[i].data(), k * sizeof(double));
+        }
+    }
+
+    static histogram_run read(const std::string & filename) {
+        std::ifstream in(filename, std::ios::binary);
+        char magic[8];
+        in.read(magic, 8);
+        if (!in || std::string(magic, 8) != "SSHIST01") throw "histogram_run: not a histogram file";
+        histogram_run ret;
+        int64_t n, k;
+        in.read((char*)&ret.kbt, sizeof(double));
+        in.read((char*)&ret.beta, sizeof(double));
+        in.read((char*)&n, sizeof(n));
+        in.read((char*)&k, sizeof(k));
+        ret.energies.resize(n);
+        ret.observables.assign(n, std::vector<double>(k));
+        for (int64_t i = 0; i < n; i++) {
+            in.read((char*)&ret.energies[i], sizeof(double));
+            in.read((char*)ret.observables[i].data(), k * sizeof(double));
+        }
+        if (!in) throw "histogram_run: truncated";
+        return ret;
+    }
+};
+
+class histogram_reweighting {
+    /* multiple histogram reweighting in its binless form (MBAR, shirts and
+     * chodera 2008; WHAM without bins). the dimensionless free energies f_k
+     * of the runs solve
+     *   f_k = -ln sum_n exp(-beta_k E_n) / sum_l N_l exp(f_l - beta_l E_n)
+     * over all samples n, after which any beta gets weights
+     *   w_n ~ exp(-beta E_n) / sum_l N_l exp(f_l - beta_l E_n).
+     * one run is single histogram reweighting. errors come from a block
+     * jackknife that drops one contiguous stretch of every run at a time,
+     * which keeps autocorrelated samples honest */
+    std::vector<histogram_run> runs;
+    std::vector<double> free_energies;
+    std::vector<std::vector<double>> replica_free_energies; /* per jackknife block */
+    double reference_energy = 0; /* subtracted from every energy against overflow */
+
+    static double log_sum_exp(const std::vector<double> & x) {
+        double top = -INFINITY;
+        for (double v : x) top = std::max(top, v);
+        if (top == -INFINITY) return top;
+        double sum = 0;
+        for (double v : x) sum += exp(v - top);
+        return top + log(sum);
+    }
+
+    /* samples of run k left out by jackknife block drop, -1 keeps all */
+    std::pair<size_t, size_t> dropped(size_t k, int drop) const {
+        if (drop < 0) return {0, 0};
+        size_t n = runs[k].size();
+        return {n * drop / blocks, n * (drop + 1) / blocks};
+    }
+
+    /* ln sum_l N_l exp(f_l - beta_l E), log_counts are ln N_l */
+    double log_denominator(double energy, const std::vector<double> & f, const std::vector<double> & log_counts) const {
+        double top = -INFINITY;
+        for (size_t l = 0; l < runs.size(); l++) {
+            top = std::max(top, log_counts[l] + f[l] - runs[l].beta * (energy - reference_energy));
+        }
+        double sum = 0;
+        for (size_t l = 0; l < runs.size(); l++) {
+            sum += exp(log_counts[l] + f[l] - runs[l].beta * (energy - reference_energy) - top);
+        }
+        return top + log(sum);
+    }
+
+    std::vector<double> log_counts(int drop) const {
+        std::vector<double> ret;
+        for (size_t k = 0; k < runs.size(); k++) {
+            auto d = dropped(k, drop);
+            ret.push_back(log(runs[k].size() - (d.second - d.first)));
+        }
+        return ret;
+    }
+
+    /* energies of the samples that jackknife block drop keeps */
+    std::vector<double> kept_energies(int drop) const {
+        std::vector<double> ret;
+        for (size_t k = 0; k < runs.size(); k++) {
+            auto d = dropped(k, drop);
+            for (size_t i = 0; i < runs[k].size(); i++) {
+                if (i < d.first || i >= d.second) ret.push_back(runs[k].energies[i]);
+            }
+        }
+        return ret;
+    }
+
+    /* self consistent iteration from f, returns the iterations used */
+    int solve(std::vector<double> & f, int drop) const {
+        std::vector<double> n = log_counts(drop);
+        std::vector<double> e = kept_energies(drop);
+        std::vector<double> top(runs.size()), sum(runs.size()), next(runs.size());
+        for (int iteration = 1; iteration <= max_iterations; iteration++) {
+            /* running log sum exp of -beta_l E - ln denominator per run l */
+            std::fill(top.begin(), top.end(), -INFINITY);
+            std::fill(sum.begin(), sum.end(), 0);
+            for (double energy : e) {
+                double ld = log_denominator(energy, f, n);
+                for (size_t l = 0; l < runs.size(); l++) {
+                    double v = -runs[l].beta * (energy - reference_energy) - ld;
+                    if (v > top[l]) {
+                        sum[l] = sum[l] * exp(top[l] - v) + 1;
+                        top[l] = v;
+                    } else {
+                        sum[l] += exp(v - top[l]);
+                    }
+                }
+            }
+            for (size_t l = 0; l < runs.size(); l++) next[l] = -(top[l] + log(sum[l]));
+            double change = 0;
+            for (size_t l = runs.size(); l-- > 0;) {
+                next[l] -= next[0];
+                change = std::max(change, std::abs(next[l] - f[l]));
+            }
+            f = next;
+            if (change < tolerance) return iteration;
+        }
+        return max_iterations;
+    }
+
+    /* starting point: free energy perturbation from each run to the next,
+     * f_{k+1} - f_k = -ln <exp(-(beta_{k+1} - beta_k) E)>_k */
+    std::vector<double> perturbation_estimate() const {
+        std::vector<double> f(runs.size(), 0);
+        for (size_t k = 0; k + 1 < runs.size(); k++) {
+            std::vector<double> x;
+            for (double e : runs[k].energies) x.push_back(-(runs[k + 1].beta - runs[k].beta) * (e - reference_energy));
+            f[k + 1] = f[k] - (log_sum_exp(x) - log(x.size()));
+        }
+        return f;
+    }
+
+    /* weighted means at beta without error bars, the energy last */
+    std::vector<double> means(double beta, const std::vector<double> & f, int drop, double * effective_samples=nullptr) const {
+        std::vector<double> n = log_counts(drop);
+        std::vector<double> log_weights;
+        for (size_t k = 0; k < runs.size(); k++) {
+            auto d = dropped(k, drop);
+            for (size_t i = 0; i < runs[k].size(); i++) {
+                if (i >= d.first && i < d.second) continue;
+                double e = runs[k].energies[i];
+                log_weights.push_back(-beta * (e - reference_energy) - log_denominator(e, f, n));
+            }
+        }
+        double norm = log_sum_exp(log_weights);
+        std::vector<double> ret(observable_count() + 1, 0);
+        double sum2 = 0;
+        size_t j = 0;
+        for (size_t k = 0; k < runs.size(); k++) {
+            auto d = dropped(k, drop);
+            for (size_t i = 0; i < runs[k].size(); i++) {
+                if (i >= d.first && i < d.second) continue;
+                double w = exp(log_weights[j++] - norm);
+                sum2 += w * w;
+                for (size_t o = 0; o < observable_count(); o++) ret[o] += w * runs[k].observables[i][o];
+                ret.back() += w * runs[k].energies[i];
+            }
+        }
+        if (effective_samples) *effective_samples = 1 / sum2;
+        return ret;
+    }
+
+public:
+    struct estimate {
+        double beta;
+        double effective_samples; /* kish, 1 / sum w^2 */
+        std::vector<double> mean; /* observables, then the energy */
+        std::vector<double> error;
+    };
+
+    int blocks = 20; /* jackknife blocks per run */
+    double tolerance = 1e-8; /* on the free energies */
+    int max_iterations = 10000;
+    int iterations = 0; /* of the last solve */
+
+    void add(const histogram_run & run) {
+        /* a kbt = 0 quench has beta = inf, exp(-beta E) of it has no overlap to reweight */
+        if (!std::isfinite(run.beta) || !(run.kbt > 0)) throw "histogram_reweighting: run needs a finite beta and kbt > 0";
+        if (run.size() < (size_t)blocks) throw "histogram_reweighting: fewer samples than jackknife blocks";
+        if (!runs.empty() && run.observables[0].size() != observable_count()) throw "histogram_reweighting: observable count differs";
+        runs.push_back(run);
+        free_energies.clear();
+    }
+
+    size_t run_count() const {
+        return runs.size();
+    }
+
+    size_t observable_count() const {
+        return runs.empty() ? 0 : runs[0].observables[0].size();
+    }
+
+    /* the dimensionless free energies of the runs, f_0 = 0, and those of
+     * the jackknife replicas */
+    const std::vector<double> & solve() {
+        if (runs.empty()) throw "histogram_reweighting: no runs";
+        reference_energy = INFINITY;
+        for (const auto & run : runs) {
+            for (double e : run.energies) reference_energy = std::min(reference_energy, e);
+        }
+        free_energies = perturbation_estimate();
+        iterations = solve(free_energies, -1);
+        replica_free_energies.assign(blocks, free_energies);
+        for (int b = 0; b < blocks; b++) solve(replica_free_energies[b], b);
+        return free_energies;
+    }
+
+    estimate at(double beta) {
+        if (free_energies.size() != runs.size()) solve();
+        estimate ret;
+        ret.beta = beta;
+        ret.mean = means(beta, free_energies, -1, &ret.effective_samples);
+        std::vector<std::vector<double>> replicas;
+        for (int b = 0; b < blocks; b++) replicas.push_back(means(beta, replica_free_energies[b], b));
+        ret.error.assign(ret.mean.size(), 0);
+        for (size_t o = 0; o < ret.mean.size(); o++) {
+            double average = 0;
+            for (const auto & r : replicas) average += r[o] / blocks;
+            for (const auto & r : replicas) ret.error[o] += (r[o] - average) * (r[o] - average);
+            ret.error[o] = sqrt(ret.error[o] * (blocks - 1.) / blocks);
+        }
+        return ret;
+    }
+
+    /* estimate at kbt, converted with the beta * kbt of the first run,
+     * which add() keeps finite */
+    estimate at_kbt(double kbt) {
+        if (runs.empty()) throw "histogram_reweighting: no runs";
+        if (!(kbt > 0) || !std::isfinite(kbt)) throw "histogram_reweighting: kbt must be finite and > 0";
+        return at(runs[0].beta * runs[0].kbt / kbt);
+    }
+
+    /* one line per kbt: kbt beta effective_samples, then mean error pairs
+     * of the observables and the energy */
+    void write(std::ostream & out, const std::vector<double> & kbts) {
+        out << "# kbt beta effective_samples (mean error)... observables then energy\n";
+        for (double kbt : kbts) {
+            estimate e = at_kbt(kbt);
+            out << kbt << " " << e.beta << " " << e.effective_samples;
+            for (size_t o = 0; o < e.mean.size(); o++) out << " " << e.mean[o] << " " << e.error[o];
+            out << "\n";
+        }
+        out << std::flush;
+    }
+};
+
+#endif
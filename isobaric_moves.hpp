@@ -0,0 +1,194 @@
+#ifndef ISOBARIC_MOVES_HPP
+#define ISOBARIC_MOVES_HPP
+
+#include <vector>
+
+#include "crystal.hpp"
+#include "monte_carlo.hpp"
+#include "parallel.hpp"
+
+class isobaric_moves {
+    /* box volume and shape moves for the NPT ensemble. pair separations
+     * are cached in scaled (extent space) coordinates, which an affine box
+     * change leaves invariant, so a trial move only re-evaluates the pair
+     * potentials for the new box matrix and never touches the particles.
+     * the cache is gathered once per batch of box moves, split across
+     * cells, and the crystal follows only when a move is accepted: a
+     * volume move scales it without a new neighbour search, a shape move
+     * rebuilds it through box_changed(). a shape move that would leave a
+     * particle outside its sheared wigner seitz cell is rejected up front.
+     * in the wigner seitz mode the cache holds the pairs of neighbour
+     * cells, every pair closer than covered in the gathered box; a trial
+     * box that could bring another pair into range first grows the
+     * neighbour range and gathers again */
+    crystal * crystalp;
+    monte_carlo * mc;
+    std::vector<std::vector<vec3>> shards;
+    bool cache_valid = false;
+    double energy = 0; /* pair energy of the current box */
+    matrix3 gathered_box;
+    double covered = INFINITY;
+
+    /* the largest offset of a particle from its cell centre */
+    double largest_offset() const {
+        double ret = 0;
+        for (const particle * p : crystalp->particles) {
+            ret = std::max(ret, crystalp->displacement(p));
+        }
+        return ret;
+    }
+
+    /* the smallest factor by which m shortens a vector, the square root of
+     * the smallest eigenvalue of m^T m from the trigonometric solution of
+     * its characteristic cubic */
+    static double smallest_stretch(const matrix3 & m) {
+        matrix3 a = m.transpose() * m;
+        double off = a.row1.y * a.row1.y + a.row1.z * a.row1.z + a.row2.z * a.row2.z;
+        double q = (a.row1.x + a.row2.y + a.row3.z) / 3;
+        double p = sqrt(((a.row1.x - q) * (a.row1.x - q) + (a.row2.y - q) * (a.row2.y - q)
+                    + (a.row3.z - q) * (a.row3.z - q) + 2 * off) / 6);
+        if (p == 0) return sqrt(std::max(q, 0.));
+        matrix3 b = matrix3::from_rows(a.row1 - vec3(q, 0, 0), a.row2 - vec3(0, q, 0), a.row3 - vec3(0, 0, q));
+        double r = std::min(std::max(b.det() / (2 * p * p * p), -1.), 1.);
+        double smallest = q + 2 * p * cos(acos(r) / 3 + 2 * M_PI / 3);
+        return sqrt(std::max(smallest, 0.));
+    }
+
+    void gather() {
+        const auto & cells = crystalp->cells;
+        const auto & particles = crystalp->particles;
+        const auto & space = crystalp->space;
+        bool ws = crystalp->wigner_seitz_constraint;
+        size_t nshards = std::max(1u, nthreads ? nthreads : std::thread::hardware_concurrency());
+        shards.resize(nshards);
+        for (auto & shard : shards) shard.clear();
+        size_t n = ws ? cells.size() : particles.size();
+        parallel_for(n, nshards, [&](size_t begin, size_t end, unsigned t) {
+            auto & shard = shards[t];
+            auto add = [&](const particle * a, const particle * b) {
+                shard.push_back(space.unproject(crystalp->separation(a, b)));
+            };
+            for (size_t i = begin; i < end; i++) {
+                if (ws) {
+                    for (const particle * a : crystalp->members(cells[i])) {
+                        for (const lattice_cell * nn : crystalp->neighbours(cells[i])) {
+                            for (const particle * b : crystalp->members(nn)) {
+                                if (a < b) add(a, b);
+                            }
+                        }
+                        for (const particle * b : crystalp->members(cells[i])) {
+                            if (a < b) add(a, b);
+                        }
+                    }
+                } else {
+                    for (size_t j = i + 1; j < particles.size(); j++) add(particles[i], particles[j]);
+                }
+            }
+        });
+        gathered_box = space.projection();
+        covered = ws ? crystalp->neighbour_range - 2 * largest_offset() : INFINITY;
+        energy = energy_at(space.projection());
+        cache_valid = true;
+    }
+
+    double energy_at(const matrix3 & h) {
+        std::vector<double> partial(shards.size(), 0);
+        parallel_for(shards.size(), shards.size(), [&](size_t begin, size_t end, unsigned) {
+            for (size_t t = begin; t < end; t++) {
+                partial[t] = crystalp->scaled_pair_energy(shards[t].data(), shards[t].size(), h);
+            }
+        });
+        double sum = 0;
+        for (double e : partial) sum += e;
+        return sum;
+    }
+
+    /* s is the factor of a volume move, 0 for a shape move */
+    void apply(const matrix3 & h, double s) {
+        if (s > 0) {
+            crystalp->scale_box(s, ln_v_max);
+            return;
+        }
+        crystalp->scale_box(periodic_space(h, crystalp->space.extents()));
+        crystalp->box_changed();
+    }
+
+    bool attempt(const matrix3 & h, double s) {
+        double range = crystalp->interaction_range();
+        if (smallest_stretch(h * gathered_box.invert()) * covered < range) {
+            double stretch = smallest_stretch(h * crystalp->space.projection().invert());
+            crystalp->grow_neighbour_range((range / stretch + 2 * largest_offset()) * (1 + 1e-9));
+            gather();
+        }
+        const matrix3 & h_old = crystalp->space.projection();
+        if (s == 0 && !crystalp->cells_hold_particles(h * h_old.invert())) {
+            ntries += 1;
+            return false;
+        }
+        double v_old = crystalp->space.volume();
+        double v_new = v_old * abs(h.det() / h_old.det());
+        double e_new = energy_at(h);
+        double n = crystalp->particles.size();
+        /* moves are uniform in ln V or ln L, hence N+1 */
+        double log_accept = -mc->beta * (e_new - energy + pressure * (v_new - v_old)) + (n + 1) * log(v_new / v_old);
+        ntries += 1;
+        if (mc->uniform() >= exp(std::min(log_accept, 0.))) return false;
+        apply(h, s);
+        energy = e_new;
+        naccept += 1;
+        return true;
+    }
+
+public:
+    double pressure;
+    double ln_v_max = 0.01; /* isotropic moves */
+    double ln_l_max = 0.01; /* moves of a single box vector length */
+    bool shape_moves = true;
+    unsigned nthreads;
+    int naccept = 0;
+    int ntries = 0;
+
+    isobaric_moves(crystal * crystalp, monte_carlo * mc, double pressure, unsigned nthreads=0) :
+        crystalp(crystalp), mc(mc), pressure(pressure), nthreads(nthreads) { }
+
+    /* has to be called after particles moved */
+    void invalidate() { cache_valid = false; }
+
+    bool step_volume() {
+        if (!cache_valid) gather();
+        double s = exp(ln_v_max * (2 * mc->uniform() - 1) / 3);
+        const matrix3 & h = crystalp->space.projection();
+        return attempt(matrix3::from_cols(h.col1() * s, h.col2() * s, h.col3() * s), s);
+    }
+
+    bool step_shape(int axis) {
+        if (!cache_valid) gather();
+        double s = exp(ln_l_max * (2 * mc->uniform() - 1));
+        const matrix3 & h = crystalp->space.projection();
+        return attempt(matrix3::from_cols(
+                    h.col1() * (axis == 0 ? s : 1),
+                    h.col2() * (axis == 1 ? s : 1),
+                    h.col3() * (axis == 2 ? s : 1)), 0);
+    }
+
+    /* times box moves after a particle sweep, returns the acceptance */
+    double sweep(int times=1) {
+        invalidate();
+        int accepted = 0;
+        for (int i = 0; i < times; i++) {
+            if (shape_moves && mc->uniform() < 0.5) {
+                accepted += step_shape(std::min(2, (int)(3 * mc->uniform())));
+            } else {
+                accepted += step_volume();
+            }
+        }
+        return times ? (double)accepted / times : 0;
+    }
+
+    double pair_energy() {
+        if (!cache_valid) gather();
+        return energy;
+    }
+};
+
+#endif
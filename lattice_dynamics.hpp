@@ -0,0 +1,207 @@
+#ifndef LATTICE_DYNAMICS_HPP
+#define LATTICE_DYNAMICS_HPP
+
+#include <unordered_map>
+#include <vector>
+
+#include "crystal.hpp"
+#include "axis_offsets.hpp"
+#include "matrix3.hpp"
+#include "parallel.hpp"
+
+class lattice_dynamics {
+    /* harmonic model of the crystal around its current configuration x0:
+     *   E(x0 + u) ~ E(x0) - f.u + u.H.u / 2
+     * with the hessian H of the pair energy, stored as 3x3 blocks per
+     * interacting pair found through the neighbour cells. at
+     * temperature kt the displacements are gaussian with mean H^+ f and
+     * covariance kt H^+, H^+ the pseudo inverse on the space orthogonal
+     * to the three uniform translations. columns of H^+ come from
+     * conjugate gradients with the diagonal blocks as preconditioner.
+     * the wigner seitz walls are not part of the model, which is fine
+     * as long as the fluctuations stay well inside the cells */
+    crystal * crystalp;
+    unsigned nthreads;
+    std::unordered_map<const particle*, size_t> index;
+    std::vector<size_t> row_start; /* block sparse rows, the diagonal block first */
+    std::vector<size_t> columns;
+    std::vector<matrix3> blocks;
+    std::vector<matrix3> diagonal_inverse;
+    std::vector<vec3> mean_displacement; /* H^+ f */
+
+    static matrix3 outer(vec3 a, vec3 b) {
+        return matrix3::from_rows(a * b.x, a * b.y, a * b.z);
+    }
+
+    static matrix3 add(const matrix3 & a, const matrix3 & b, double factor=1) {
+        return matrix3::from_rows(a.row1 + b.row1 * factor, a.row2 + b.row2 * factor, a.row3 + b.row3 * factor);
+    }
+
+    static double dot(const std::vector<vec3> & a, const std::vector<vec3> & b) {
+        double ret = 0;
+        for (size_t i = 0; i < a.size(); i++) ret += a[i] * b[i];
+        return ret;
+    }
+
+    /* removes the uniform translation component */
+    static void project(std::vector<vec3> & x) {
+        vec3 mean;
+        for (const vec3 & v : x) mean += v / x.size();
+        for (vec3 & v : x) v -= mean;
+    }
+
+    void build() {
+        auto & particles = crystalp->particles;
+        for (size_t i = 0; i < particles.size(); i++) index[particles[i]] = i;
+        double range = crystalp->interaction_range();
+        row_start.push_back(0);
+        for (const particle * self : particles) {
+            matrix3 diagonal;
+            size_t diagonal_at = blocks.size();
+            columns.push_back(index[self]);
+            blocks.push_back(diagonal);
+            auto add_pair = [&](const particle * p) {
+                if (p == self) return;
+                vec3 d = crystalp->separation(self, p);
+                double r = d.length();
+                if (r >= range) return;
+                vec3 n = d / r;
+                /* d2/dxi dxj V(|xi - xj|) = -(V'' n n + V'/r (1 - n n)) */
+                double curvature = crystalp->potential_curvature(r);
+                double tension = crystalp->potential_derivative(r) / r;
+                matrix3 nn = outer(n, n);
+                matrix3 block = add(matrix3::from_rows(vec3(tension, 0, 0), vec3(0, tension, 0), vec3(0, 0, tension)),
+                        nn, curvature - tension);
+                columns.push_back(index.at(p));
+                blocks.push_back(add(matrix3(), block, -1));
+                diagonal = add(diagonal, block);
+            };
+            for (const particle * p : crystalp->members(crystalp->cell_of(self))) add_pair(p);
+            for (const lattice_cell * nn : crystalp->neighbours(crystalp->cell_of(self))) {
+                for (const particle * p : crystalp->members(nn)) add_pair(p);
+            }
+            blocks[diagonal_at] = diagonal;
+            diagonal_inverse.push_back(diagonal.det() > 0 ? diagonal.invert() : matrix3());
+            row_start.push_back(blocks.size());
+        }
+    }
+
+    /* preconditioned conjugate gradients for H x = b on the translation
+     * free subspace, threads splits the products */
+    int solve(std::vector<vec3> b, std::vector<vec3> & x, unsigned threads) const {
+        size_t n = b.size();
+        project(b);
+        x.assign(n, vec3());
+        std::vector<vec3> r = b, z(n), p(n), q(n);
+        auto precondition = [&]() {
+            for (size_t i = 0; i < n; i++) z[i] = diagonal_inverse[i] * r[i];
+            project(z);
+        };
+        precondition();
+        p = z;
+        double rz = dot(r, z);
+        double bb = dot(b, b);
+        if (bb == 0) return 0;
+        for (int iteration = 1; iteration <= max_iterations; iteration++) {
+            multiply(p, q, threads);
+            double pq = dot(p, q);
+            if (!(pq > 0)) throw "lattice_dynamics: hessian is not positive definite, relax the configuration first";
+            double alpha = rz / pq;
+            for (size_t i = 0; i < n; i++) {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * q[i];
+            }
+            if (dot(r, r) < tolerance * tolerance * bb) return iteration;
+            precondition();
+            double rz_next = dot(r, z);
+            for (size_t i = 0; i < n; i++) p[i] = z[i] + (rz_next / rz) * p[i];
+            rz = rz_next;
+        }
+        throw "lattice_dynamics: conjugate gradients did not converge";
+    }
+
+public:
+    double tolerance = 1e-8; /* relative residual */
+    int max_iterations = 10000;
+
+    struct profile {
+        std::vector<double> mean; /* offsets along the profile direction */
+        std::vector<double> variance;
+        std::vector<std::vector<double>> covariance;
+    };
+
+    /* the configuration is taken as it is now, kernels have to be selected */
+    lattice_dynamics(crystal * crystalp, unsigned nthreads=0) : crystalp(crystalp), nthreads(nthreads) {
+        build();
+        std::vector<vec3> force;
+        for (const particle * p : crystalp->particles) force.push_back(crystalp->particle_force(p));
+        solve(force, mean_displacement, nthreads);
+    }
+
+    size_t size() const {
+        return row_start.size() - 1;
+    }
+
+    size_t nonzero_blocks() const {
+        return blocks.size();
+    }
+
+    /* y = H x, particles in crystal->particles order */
+    void multiply(const std::vector<vec3> & x, std::vector<vec3> & y, unsigned threads) const {
+        y.resize(x.size());
+        parallel_for(size(), threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                vec3 sum;
+                for (size_t k = row_start[i]; k < row_start[i + 1]; k++) sum += blocks[k] * x[columns[k]];
+                y[i] = sum;
+            }
+        });
+    }
+
+    /* kt H^+ e for a unit displacement e of particle p along direction */
+    std::vector<vec3> response(const particle * p, vec3 direction, double kt, unsigned threads=1) const {
+        std::vector<vec3> b(size()), x;
+        b[index.at(p)] = direction;
+        solve(b, x, threads);
+        for (vec3 & v : x) v = v * kt;
+        return x;
+    }
+
+    /* position at the minimum of the harmonic model */
+    vec3 mean_position(const particle * p) const {
+        return crystalp->position(p) + mean_displacement[index.at(p)];
+    }
+
+    /* kt times the inverse diagonal block, the shape of a single particle
+     * gaussian proposal that follows the local curvature, usable to
+     * precondition collective moves */
+    matrix3 local_covariance(const particle * p, double kt) const {
+        return add(matrix3(), diagonal_inverse[index.at(p)], kt);
+    }
+
+    /* harmonic prediction of an axis_offsets profile at kt, one solve per
+     * particle of the profile spread over the threads */
+    profile predict(const axis_offsets & offsets, double kt) const {
+        size_t n = offsets.particles.size();
+        vec3 u = offsets.direction();
+        profile ret;
+        ret.mean.resize(n);
+        ret.variance.resize(n);
+        ret.covariance.assign(n, std::vector<double>(n));
+        std::vector<std::vector<vec3>> responses(n);
+        parallel_for(n, nthreads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t a = begin; a < end; a++) responses[a] = response(offsets.particles[a].p, u, kt);
+        });
+        for (size_t a = 0; a < n; a++) {
+            const particle * p = offsets.particles[a].p;
+            ret.mean[a] = crystalp->space.difference(crystalp->center(crystalp->cell_of(p)), mean_position(p)) * u;
+            for (size_t b = 0; b < n; b++) {
+                ret.covariance[a][b] = responses[a][index.at(offsets.particles[b].p)] * u;
+            }
+            ret.variance[a] = ret.covariance[a][a];
+        }
+        return ret;
+    }
+};
+
+#endif
@@ -1,53 +1,332 @@
 #ifndef MONTE_CARLO_HPP
 #define MONTE_CARLO_HPP
 
+#include <random>
+#include <vector>
+
 #include "crystal.hpp"
+#include "visit_schedule.hpp"
 
 class monte_carlo {
+    /* scratch space of the multiple-try moves */
+    std::vector<vec3> shifts, negated_shifts, separations, separations2;
+    std::vector<double> forward, backward;
+    std::vector<bool> forward_inside, backward_inside;
+
+    /* multiple-try metropolis (liu, liang and wong 2000) with weights
+     * exp(-beta E): k candidates around x, one picked by weight, k-1
+     * reference points around it plus x itself, accepted with probability
+     * sum w(candidates) / sum w(references). candidates outside the wigner
+     * seitz cell weigh 0, which keeps the uniform proposal symmetric.
+     * energies(shifts, k, out) adds the energies of a whole set to out */
+    template<typename Inside, typename Energies>
+    bool multiple_try(Inside inside, Energies energies, vec3 & chosen) {
+        size_t k = tries;
+        shifts.resize(k);
+        forward_inside.resize(k);
+        backward_inside.resize(k);
+        bool any = false;
+        for (size_t i = 0; i < k; i++) {
+            shifts[i] = random_displacement();
+            forward_inside[i] = inside(shifts[i]);
+            any = any || forward_inside[i];
+        }
+        if (!any) return false;
+        forward.assign(k, 0);
+        energies(shifts.data(), k, forward.data());
+        double reference = INFINITY;
+        for (size_t i = 0; i < k; i++) {
+            if (forward_inside[i]) reference = std::min(reference, forward[i]);
+        }
+        double total = 0;
+        for (size_t i = 0; i < k; i++) {
+            if (forward_inside[i]) total += exp(-beta*(forward[i] - reference));
+        }
+        double target = uniform() * total;
+        size_t pick = k;
+        for (size_t i = 0; i < k; i++) {
+            if (!forward_inside[i]) continue;
+            pick = i;
+            target -= exp(-beta*(forward[i] - reference));
+            if (target < 0) break;
+        }
+        chosen = shifts[pick];
+        for (size_t i = 0; i + 1 < k; i++) {
+            shifts[i] = chosen + random_displacement();
+            backward_inside[i] = inside(shifts[i]);
+        }
+        shifts[k - 1] = vec3();
+        backward_inside[k - 1] = true;
+        backward.assign(k, 0);
+        energies(shifts.data(), k, backward.data());
+        for (size_t i = 0; i < k; i++) {
+            if (backward_inside[i]) reference = std::min(reference, backward[i]);
+        }
+        double numerator = 0, denominator = 0;
+        for (size_t i = 0; i < k; i++) {
+            if (forward_inside[i]) numerator += exp(-beta*(forward[i] - reference));
+            if (backward_inside[i]) denominator += exp(-beta*(backward[i] - reference));
+        }
+        return uniform() * denominator < numerator;
+    }
+
+    /* spring energy of p moved by shift, zero unless coupled */
+    double tether(const particle * p, vec3 shift) const {
+        if (spring == 0) return 0;
+        vec3 x = crystalp->offset(p) + shift;
+        return spring * (x * x);
+    }
+
+    bool coupled() const {
+        return lambda != 1 || spring != 0;
+    }
+
+    /* particle of the next move of a weighted sweep */
+    size_t visit() {
+        if (visits.size() != crystalp->particles.size()) throw "monte_carlo: visit schedule is stale, particles changed";
+        return visits.draw(rng);
+    }
+
+    /* a trial move drawn ahead by the pipelined sweeps */
+    struct proposal {
+        particle * p1;
+        particle * p2; /* null for single particle moves */
+        vec3 candidate; /* the first, redrawn if it leaves a cell */
+        double u; /* of the acceptance */
+    };
+    std::vector<proposal> proposals;
+
+    /* the moves of one pipelined sweep: the proposals of a block are drawn
+     * first, then run in order while the neighbourhoods of the next ones
+     * are prefetched, stage s for the move (prefetch_stages - s)
+     * prefetch_distance ahead */
+    int pipelined_sweep(bool sym) {
+        auto & particles = crystalp->particles;
+        size_t n = particles.size();
+        long ahead = crystal::prefetch_stages * (long)prefetch_distance;
+        int naccept = 0;
+        for (size_t begin = 0; begin < n; begin += proposal_block) {
+            long count = std::min(n - begin, (size_t)proposal_block);
+            proposals.resize(count);
+            for (long i = 0; i < count; i++) {
+                proposal & pr = proposals[i];
+                size_t idxp1 = visits.empty() ? begin + i : visit();
+                pr.p1 = particles[idxp1];
+                pr.p2 = nullptr;
+                if (sym) {
+                    size_t idxp2 = std::uniform_int_distribution<size_t>(0, n - 2)(rng);
+                    if (idxp2 >= idxp1) idxp2 += 1;
+                    pr.p2 = particles[idxp2];
+                }
+                pr.candidate = random_displacement();
+                pr.u = uniform();
+            }
+            for (long i = -ahead; i < count; i++) {
+                for (int stage = 0; stage < crystal::prefetch_stages; stage++) {
+                    long j = i + (crystal::prefetch_stages - stage) * (long)prefetch_distance;
+                    if (j < 0 || j >= count) continue;
+                    crystalp->prefetch(proposals[j].p1, stage);
+                    if (sym) crystalp->prefetch(proposals[j].p2, stage);
+                }
+                if (i < 0) continue;
+                const proposal & pr = proposals[i];
+                vec3 candidate = pr.candidate;
+                if (sym) {
+                    while (!inside_sym(pr.p1, pr.p2, candidate)) candidate = random_displacement();
+                    naccept += move_sym(pr.p1, pr.p2, candidate, pr.u);
+                } else {
+                    while (!crystalp->in_cell(pr.p1, candidate)) candidate = random_displacement();
+                    naccept += move_1p(pr.p1, candidate, pr.u);
+                }
+            }
+        }
+        return naccept;
+    }
+
+    bool inside_sym(const particle * p1, const particle * p2, vec3 candidate) const {
+        return crystalp->in_cell(p1, candidate) && crystalp->in_cell(p2, -candidate);
+    }
+
+    /* the metropolis test of a candidate inside the cell with the uniform
+     * u of the acceptance, and the update */
+    bool move_1p(particle * p, vec3 candidate, double u) {
+        crystalp->cover(p, candidate);
+        double springs = tether(p, candidate) - tether(p, vec3());
+        bool accept;
+        if (lambda == 0) {
+            accept = springs < acceptance_threshold(u);
+        } else if (early_rejection) {
+            double old_energy = crystalp->particle_energy(p);
+            double limit = old_energy + (acceptance_threshold(u) - springs) / lambda;
+            accept = crystalp->bounded_particle_energy(p, candidate, limit) < limit;
+        } else {
+            double old_energy = crystalp->particle_energy(p);
+            double new_energy = crystalp->particle_energy(p, candidate);
+            double p_accept = exp(-beta*(lambda*(new_energy-old_energy) + springs));
+            accept = u < std::min(p_accept, 1.);
+        }
+        if (accept) {
+            crystalp->move(p, candidate);
+        }
+        return accept;
+    }
+
+    bool move_sym(particle * p1, particle * p2, vec3 candidate, double u) {
+        crystalp->cover(p1, candidate);
+        crystalp->cover(p2, -candidate);
+        double springs = tether(p1, candidate) + tether(p2, -candidate) - tether(p1, vec3()) - tether(p2, vec3());
+        bool accept;
+        if (lambda == 0) {
+            accept = springs < acceptance_threshold(u);
+        } else if (early_rejection) {
+            double old_energy = crystalp->two_particle_energy(p1, p2);
+            double limit = old_energy + (acceptance_threshold(u) - springs) / lambda;
+            accept = crystalp->bounded_two_particle_energy(p1, p2, candidate, -candidate, limit) < limit;
+        } else {
+            double old_energy = crystalp->two_particle_energy(p1, p2);
+            double new_energy = crystalp->two_particle_energy(p1, p2, candidate, -candidate);
+            double p_accept = exp(-beta*(lambda*(new_energy-old_energy) + springs));
+            accept = u < std::min(p_accept, 1.);
+        }
+        if (accept) {
+            crystalp->move(p1, candidate);
+            crystalp->move(p2, -candidate);
+        }
+        return accept;
+    }
+
+    /* counts the sweep and runs the periodic full energy audit */
+    void end_sweep() {
+        sweeps_done += 1;
+        int every = crystalp->validation.audit_every;
+        if (every > 0 && sweeps_done % every == 0) crystalp->audit(sweeps_done);
+    }
+
 public:
     double r_max;
     crystal * crystalp;
     double beta;
-    monte_carlo(crystal * c) {
+    std::mt19937 rng; /* per engine, so independent runs can share a process */
+    /* draw the uniform first and stop the new energy sum as soon as it
+     * rules the move out, samples the same ensemble */
+    bool early_rejection = false;
+    /* candidates per move, more than 1 selects multiple-try metropolis */
+    int tries = 1;
+    int64_t sweeps_done = 0;
+    /* weighted choice of the moved particles, empty visits every particle
+     * once per sweep in order */
+    visit_schedule visits;
+    /* frenkel ladd coupling, sampled is lambda times the pair energy plus
+     * spring |pos - cell centre|^2 per particle (see
+     * thermodynamic_integration.hpp), 1 and 0 for the plain crystal */
+    double lambda = 1;
+    double spring = 0;
+    /* pipelined sweeps when positive: proposals (particle, partner, first
+     * candidate and acceptance uniform) are drawn this many at a time and
+     * the neighbourhoods of the coming moves prefetched while the current
+     * one runs. the moves still run one after the other, each on the
+     * positions left by the one before, and the proposals do not depend on
+     * them, so the chain is the same in distribution; only the order in
+     * which random numbers are drawn differs. multiple-try moves are not
+     * pipelined */
+    int proposal_block = 0;
+    int prefetch_distance = 2; /* moves between prefetch stages */
+    monte_carlo(crystal * c, unsigned seed=0) : rng(seed) {
         crystalp = c;
         r_max = 1;
         beta = 1;
     }
 
+    double uniform() {
+        return std::uniform_real_distribution<double>(0, 1)(rng);
+    }
+
+    vec3 random_displacement() {
+        return r_max * vec3(2*uniform() - 1, 2*uniform() - 1, 2*uniform() - 1);
+    }
+
+    /* u < exp(-beta dE) is dE < -log(u) / beta */
+    double acceptance_threshold(double u) const {
+        return -std::log(u) / beta;
+    }
+
+    double acceptance_threshold() {
+        return acceptance_threshold(uniform());
+    }
+
     bool step_1p(particle * p) {
         vec3 candidate;
         while (true) {
-            candidate = r_max * (vec3(2,2,2).random() - vec3(1,1,1));
-            if (p->cell->contains(p->pos + candidate)) break;
+            candidate = random_displacement();
+            if (crystalp->in_cell(p, candidate)) break;
         }
-        double old_energy = p->energy();
-        double new_energy = p->energy(candidate);
-        double p_accept = exp(-beta*(new_energy-old_energy));
-        bool accept = (rand() / (double)RAND_MAX) < std::min(p_accept, 1.);
-        if (accept) {
-            p->pos = crystalp->space.clip(p->pos + candidate);
-        }
-        return accept;
+        return move_1p(p, candidate, uniform());
     }
 
     bool step_sym(particle * p1, particle * p2) {
         vec3 candidate;
         while (true) {
-            candidate = r_max * (vec3(2,2,2).random() - vec3(1,1,1));
-            if (p1->cell->contains(p1->pos + candidate) &&
-                p2->cell->contains(p2->pos - candidate)) break;
-        }
-        /*if ((p1->cell->n == vec3(2, 2, 2) && p1->cell->basis == 0) ||
-            (p2->cell->n == vec3(2, 2, 2) && p2->cell->basis == 0)) {
-            candidate = candidate / 20;
-        }*/
-        double old_energy = crystalp->two_particle_energy(p1, p2);
-        double new_energy = crystalp->two_particle_energy(p1, p2, candidate, -candidate);
-        double p_accept = exp(-beta*(new_energy-old_energy));
-        bool accept = (rand() / (double)RAND_MAX) < std::min(p_accept, 1.);
+            candidate = random_displacement();
+            if (inside_sym(p1, p2, candidate)) break;
+        }
+        return move_sym(p1, p2, candidate, uniform());
+    }
+
+    bool step_1p_mtm(particle * p) {
+        int gathered = -1;
+        auto inside = [&](const vec3 & d) {
+            if (!crystalp->in_cell(p, d)) return false;
+            crystalp->cover(p, d);
+            return true;
+        };
+        auto energies = [&](const vec3 * d, size_t k, double * out) {
+            if (gathered != crystalp->neighbour_rebuilds) {
+                crystalp->gather_separations(p, nullptr, separations);
+                gathered = crystalp->neighbour_rebuilds;
+            }
+            crystalp->shifted_energies(separations, d, k, out);
+            if (coupled()) {
+                for (size_t i = 0; i < k; i++) out[i] = lambda*out[i] + tether(p, d[i]);
+            }
+        };
+        vec3 y;
+        bool accept = multiple_try(inside, energies, y);
+        if (accept) {
+            crystalp->move(p, y);
+        }
+        return accept;
+    }
+
+    /* pair weights use the same energy as step_sym, two_particle_energy() */
+    bool step_sym_mtm(particle * p1, particle * p2) {
+        int gathered = -1;
+        auto inside = [&](const vec3 & d) {
+            if (!crystalp->in_cell(p1, d) || !crystalp->in_cell(p2, -d)) return false;
+            crystalp->cover(p1, d);
+            crystalp->cover(p2, -d);
+            return true;
+        };
+        auto energies = [&](const vec3 * d, size_t k, double * out) {
+            if (gathered != crystalp->neighbour_rebuilds) {
+                crystalp->gather_separations(p1, p2, separations);
+                crystalp->gather_separations(p2, p1, separations2);
+                gathered = crystalp->neighbour_rebuilds;
+            }
+            negated_shifts.resize(k);
+            for (size_t i = 0; i < k; i++) negated_shifts[i] = -d[i];
+            crystalp->shifted_energies(separations, d, k, out);
+            crystalp->shifted_energies(separations2, negated_shifts.data(), k, out);
+            vec3 r12 = crystalp->separation(p1, p2);
+            for (size_t i = 0; i < k; i++) out[i] += 2*crystalp->potential((r12 - 2*d[i]).length());
+            if (coupled()) {
+                for (size_t i = 0; i < k; i++) out[i] = lambda*out[i] + tether(p1, d[i]) + tether(p2, -d[i]);
+            }
+        };
+        vec3 y;
+        bool accept = multiple_try(inside, energies, y);
         if (accept) {
-            p1->pos = crystalp->space.clip(p1->pos + candidate);
-            p2->pos = crystalp->space.clip(p2->pos - candidate);
+            crystalp->move(p1, y);
+            crystalp->move(p2, -y);
         }
         return accept;
     }
@@ -55,9 +334,19 @@ public:
     double sweep_1p(int times=1) {
         int naccept = 0;
         for (int time = 0; time < times; time++) {
-            for (particle * p : crystalp->particles) {
-                naccept += step_1p(p);
+            if (proposal_block > 0 && tries == 1) {
+                naccept += pipelined_sweep(false);
+            } else if (!visits.empty()) {
+                for (size_t i = 0; i < crystalp->particles.size(); i++) {
+                    particle * p = crystalp->particles[visit()];
+                    naccept += tries > 1 ? step_1p_mtm(p) : step_1p(p);
+                }
+            } else {
+                for (particle * p : crystalp->particles) {
+                    naccept += tries > 1 ? step_1p_mtm(p) : step_1p(p);
+                }
             }
+            end_sweep();
         }
         return (double)naccept / times / crystalp->particles.size();
     }
@@ -65,13 +354,21 @@ public:
     double sweep_sym(int times=1) {
         int naccept = 0;
         for (int time = 0; time < times; time++) {
-            int idxp1 = 0;
-            for (particle * p : crystalp->particles) {
-                int idxp2 = rand() % (crystalp->particles.size() - 1);
+            if (proposal_block > 0 && tries == 1) {
+                naccept += pipelined_sweep(true);
+                end_sweep();
+                continue;
+            }
+            /* the pair (p1, p2) is picked with probability (w1 + w2) / (N - 1)
+             * either way round, the same for the move and its reverse */
+            for (size_t i = 0; i < crystalp->particles.size(); i++) {
+                int idxp1 = visits.empty() ? i : visit();
+                int idxp2 = std::uniform_int_distribution<int>(0, crystalp->particles.size() - 2)(rng);
                 if (idxp2 >= idxp1) idxp2 += 1;
-                naccept += step_sym(p, crystalp->particles[idxp2]);
-                idxp1 += 1;
+                particle * p = crystalp->particles[idxp1];
+                naccept += tries > 1 ? step_sym_mtm(p, crystalp->particles[idxp2]) : step_sym(p, crystalp->particles[idxp2]);
             }
+            end_sweep();
         }
         return (double)naccept / times / crystalp->particles.size();
     }
@@ -81,6 +378,37 @@ public:
         else return sweep_1p(ntimes);
     }
 
+    /* autocorrelation time in sweeps of the offset of every particle from
+     * its cell centre, (1 + rho) / (1 - rho) from the lag one correlation
+     * rho over the given sweeps, as for an exponential decay. slow regions
+     * like a defect core stand out against the bulk */
+    std::vector<double> offset_autocorrelation(int sweeps, bool sym=true) {
+        if (sweeps < 1) throw "monte_carlo: autocorrelation needs at least one sweep";
+        auto & particles = crystalp->particles;
+        size_t n = particles.size();
+        std::vector<vec3> sum(n), last(n);
+        std::vector<double> square(n), lag(n);
+        for (int t = 0; t <= sweeps; t++) {
+            if (t > 0) sweep(1, sym);
+            for (size_t i = 0; i < n; i++) {
+                vec3 x = crystalp->offset(particles[i]);
+                if (t > 0) lag[i] += x * last[i];
+                sum[i] += x;
+                square[i] += x * x;
+                last[i] = x;
+            }
+        }
+        std::vector<double> ret;
+        for (size_t i = 0; i < n; i++) {
+            vec3 mean = sum[i] / (sweeps + 1);
+            double variance = square[i] / (sweeps + 1) - mean * mean;
+            double rho = variance > 0 ? (lag[i] / sweeps - mean * mean) / variance : 0;
+            rho = std::min(std::max(rho, 0.), 0.999);
+            ret.push_back((1 + rho) / (1 - rho));
+        }
+        return ret;
+    }
+
     void train(bool sym=true, double pacc_goal=0.3, double r_from=0.0001, double r_to=3, int width=50, int height=3, int nsweeps=5) {
         double r_best = r_from;
         double pacc_dist_best = 1;
@@ -0,0 +1,34 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+/* splits [0, n) into one contiguous range per thread and calls
+ * fn(begin, end, thread index), the calling thread takes the first range.
+ * all threads are joined before the first exception thrown in any of them
+ * is rethrown */
+template<typename F>
+void parallel_for(size_t n, unsigned nthreads, F fn) {
+    if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+    nthreads = std::max<size_t>(1, std::min<size_t>(nthreads, n));
+    size_t chunk = (n + nthreads - 1) / nthreads;
+    std::vector<std::exception_ptr> errors(nthreads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < nthreads; t++) {
+        size_t begin = std::min(n, t * chunk);
+        size_t end = std::min(n, begin + chunk);
+        workers.emplace_back([=, &errors]() {
+            try { fn(begin, end, t); }
+            catch (...) { errors[t] = std::current_exception(); }
+        });
+    }
+    try { fn(0, std::min(n, chunk), 0u); }
+    catch (...) { errors[0] = std::current_exception(); }
+    for (auto & worker : workers) worker.join();
+    for (auto & error : errors) if (error) std::rethrow_exception(error);
+}
+
+#endif
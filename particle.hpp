@@ -1,19 +1,18 @@
 #ifndef PARTICLE_HPP
 #define PARTICLE_HPP
 
-#include "vec3.hpp"
-
-class lattice_cell;
-class crystal;
+#include <cstdint>
 
+/* a slot in the particle storage of its crystal, which keeps the position
+ * and hands it out through crystal::position() */
 class particle {
 public:
-    vec3 pos;
-    lattice_cell * cell;
-    crystal * owner;
-    int color = 1;
-    int size = 1;
-    double energy(vec3 shift=vec3(0, 0, 0));
+    static constexpr uint32_t none = 0xffffffff;
+    uint32_t cell = none; /* slot of its cell, none once released */
+    uint32_t next = none; /* slot of the next particle in the same cell */
+    int id = -1; /* stable across reordering, assigned at creation */
+    int16_t color = 1;
+    int16_t size = 1;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef PERIODIC_SPACE_HPP
 #define PERIODIC_SPACE_HPP
 
+#include <algorithm>
 #include <cassert>
 
 #include "vec3.hpp"
@@ -11,17 +12,30 @@ class periodic_space {
     matrix3 mat_project; /* from extent space to periodic space, columns are unit cell p1, p2 and p3 */
     matrix3 mat_project_inv; /* from periodic space to extent space */
     vec3 extent; /* real space ([0,extent.x], [0,extent.y], [0,extent.z]) */
+    bool is_orthorhombic; /* mat_project is diagonal */
+    vec3 box; /* orthorhombic only: box lengths along x, y and z */
+    vec3 box_inv;
 public:
     periodic_space(matrix3 mat_project, vec3 extent) :
         mat_project(mat_project), mat_project_inv(mat_project.invert()), extent(extent) {
+            is_orthorhombic =
+                mat_project.row1.y == 0 && mat_project.row1.z == 0 &&
+                mat_project.row2.x == 0 && mat_project.row2.z == 0 &&
+                mat_project.row3.x == 0 && mat_project.row3.y == 0;
+            box = vec3(mat_project.row1.x, mat_project.row2.y, mat_project.row3.z).mul(extent);
+            box_inv = vec3(1/box.x, 1/box.y, 1/box.z);
             assert((mat_project * (mat_project_inv * vec3(1,0,0))).close_to(vec3(1,0,0)));
             assert((mat_project * (mat_project_inv * vec3(1,-5,3))).close_to(vec3(1,-5,3)));
-            assert(clip(vec3()).close_to(vec3()));
-            assert(clip(mat_project.col1()/2).close_to(mat_project.col1()/2));
-            assert(clip(mat_project.col2()/2).close_to(mat_project.col2()/2));
-            assert(clip(mat_project.col3()/2).close_to(mat_project.col3()/2));
+            /* compared up to a period, clip may wrap a rounding error of -0 to the far side */
+            assert(distance(clip(vec3()), vec3()) < 1e-4);
+            assert(distance(clip(mat_project.col1()/2), mat_project.col1()/2) < 1e-4);
+            assert(distance(clip(mat_project.col2()/2), mat_project.col2()/2) < 1e-4);
+            assert(distance(clip(mat_project.col3()/2), mat_project.col3()/2) < 1e-4);
     }
     vec3 project(const vec3 & a) const { return mat_project * a; }
+    vec3 unproject(const vec3 & a) const { return mat_project_inv * a; }
+    const matrix3 & projection() const { return mat_project; }
+    vec3 extents() const { return extent; }
     vec3 difference(vec3 a, vec3 b) const {
         vec3 u = mat_project_inv * (b - a);
         while (u.x >= extent.x / 2) u.x -= extent.x;
@@ -35,6 +49,41 @@ public:
     double distance(vec3 a, vec3 b) const {
         return difference(a, b).length();
     }
+    bool orthorhombic() const { return is_orthorhombic; }
+
+    /* branch-free variants for the energy kernels, ORTHO must match orthorhombic() */
+    template<bool ORTHO>
+    vec3 difference_kernel(const vec3 & a, const vec3 & b) const {
+        if constexpr (ORTHO) {
+            vec3 d = b - a;
+            d.x -= box.x * floor(d.x * box_inv.x + 0.5);
+            d.y -= box.y * floor(d.y * box_inv.y + 0.5);
+            d.z -= box.z * floor(d.z * box_inv.z + 0.5);
+            return d;
+        } else {
+            vec3 u = mat_project_inv * (b - a);
+            u.x -= extent.x * floor(u.x / extent.x + 0.5);
+            u.y -= extent.y * floor(u.y / extent.y + 0.5);
+            u.z -= extent.z * floor(u.z / extent.z + 0.5);
+            return mat_project * u;
+        }
+    }
+    template<bool ORTHO>
+    double distance_kernel(const vec3 & a, const vec3 & b) const {
+        return difference_kernel<ORTHO>(a, b).length();
+    }
+    template<bool ORTHO>
+    vec3 clip_kernel(const vec3 & a) const {
+        if constexpr (ORTHO) {
+            vec3 u = a;
+            u.x -= box.x * floor(u.x * box_inv.x);
+            u.y -= box.y * floor(u.y * box_inv.y);
+            u.z -= box.z * floor(u.z * box_inv.z);
+            return u;
+        } else {
+            return clip(a);
+        }
+    }
     vec3 clip(const vec3 & a) const {
         vec3 u = (mat_project_inv * a).div(extent);
         u.x = u.x - floor(u.x);
@@ -79,6 +128,14 @@ public:
     double volume() const {
         return abs(p1() * (p2().cross(p3())));
     }
+    /* half the smallest distance between opposite box faces. wrapping the
+     * extent space coordinates gives the minimum image only for separations
+     * below it, beyond it a skewed box may pick a farther image */
+    double inscribed_radius() const {
+        double v = volume();
+        return std::min({v / p2().cross(p3()).length(), v / p3().cross(p1()).length(),
+                v / p1().cross(p2()).length()}) / 2;
+    }
 };
 
 #endif
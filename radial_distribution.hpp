@@ -0,0 +1,92 @@
+#ifndef RADIAL_DISTRIBUTION_HPP
+#define RADIAL_DISTRIBUTION_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "crystal.hpp"
+#include "parallel.hpp"
+
+class radial_distribution {
+    /* g(r) accumulated on the fly. with the wigner seitz constraint the
+     * pairs come from the neighbouring cells, so r_max has to stay within
+     * crystal::pair_range(); otherwise all pairs are visited */
+    crystal * crystalp;
+    std::vector<std::vector<double>> shards; /* one histogram per thread */
+    double density_sum = 0;
+    double particles_sum = 0;
+public:
+    double r_max;
+    int nbins;
+    unsigned nthreads;
+    int64_t nsamples = 0;
+    std::vector<double> histogram; /* ordered pair counts summed over samples */
+
+    radial_distribution(crystal * crystalp, double r_max, int nbins=200, unsigned nthreads=0) :
+        crystalp(crystalp), r_max(r_max), nbins(nbins), nthreads(nthreads), histogram(nbins, 0) {
+        if (r_max > crystalp->pair_range()) throw "radial_distribution: r_max beyond the pairs the neighbour cells hold";
+    }
+
+    void measure() {
+        const auto & particles = crystalp->particles;
+        double bin_inv = nbins / r_max;
+        bool ws = crystalp->wigner_seitz_constraint;
+        shards.resize(std::max(1u, nthreads ? nthreads : std::thread::hardware_concurrency()));
+        for (auto & shard : shards) shard.assign(nbins, 0);
+        parallel_for(particles.size(), shards.size(), [&](size_t begin, size_t end, unsigned t) {
+            auto & shard = shards[t];
+            auto add = [&](const particle * a, const particle * b) {
+                double r = crystalp->separation(a, b).length();
+                if (r < r_max) shard[(int)(r * bin_inv)] += 1;
+            };
+            for (size_t i = begin; i < end; i++) {
+                const particle * a = particles[i];
+                if (ws) {
+                    for (const lattice_cell * nn : crystalp->neighbours(crystalp->cell_of(a))) {
+                        for (const particle * b : crystalp->members(nn)) add(a, b);
+                    }
+                    for (const particle * b : crystalp->members(crystalp->cell_of(a))) {
+                        if (b != a) add(a, b);
+                    }
+                } else {
+                    for (const particle * b : particles) {
+                        if (b != a) add(a, b);
+                    }
+                }
+            }
+        });
+        for (const auto & shard : shards) {
+            for (int b = 0; b < nbins; b++) histogram[b] += shard[b];
+        }
+        density_sum += crystalp->density();
+        particles_sum += particles.size();
+        nsamples += 1;
+    }
+
+    std::vector<double> g() const {
+        std::vector<double> ret(nbins, 0);
+        if (nsamples == 0) return ret;
+        double dr = r_max / nbins;
+        double rho = density_sum / nsamples;
+        double n = particles_sum / nsamples;
+        for (int b = 0; b < nbins; b++) {
+            double shell = 4./3 * M_PI * (pow((b + 1) * dr, 3) - pow(b * dr, 3));
+            ret[b] = histogram[b] / (nsamples * n * rho * shell);
+        }
+        return ret;
+    }
+
+    /* binary: int32 nbins, double r_max, int64 nsamples, double g[nbins] */
+    void write(const std::string & filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        int32_t n = nbins;
+        out.write((const char*)&n, sizeof(n));
+        out.write((const char*)&r_max, sizeof(r_max));
+        out.write((const char*)&nsamples, sizeof(nsamples));
+        auto values = g();
+        out.write((const char*)values.data(), values.size() * sizeof(double));
+    }
+};
+
+#endif
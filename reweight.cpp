@@ -0,0 +1,34 @@
+// BUILD g++ reweight.cpp -O2 -Wall -std=c++17 -o reweight
+
+/* combines the histogram.bin files of runs at different temperatures
+ * (histogram=N in the scenario) and estimates the offsets and the energy
+ * at other temperatures by multiple histogram reweighting:
+ *   reweight 0.0005,0.0015,0.0025 sim/a/histogram.bin sim/b/histogram.bin
+ * writes one line per kbt: kbt beta effective_samples, then mean error
+ * pairs of every observable and finally the energy */
+
+#include <iostream>
+#include <sstream>
+
+#include "histogram_reweighting.hpp"
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: reweight [kbt,kbt,...] [histogram file]..." << std::endl;
+        exit(1);
+    }
+    try {
+        std::vector<double> kbts;
+        std::istringstream s(argv[1]);
+        std::string item;
+        while (std::getline(s, item, ',')) kbts.push_back(std::stod(item));
+        histogram_reweighting reweighting;
+        for (int i = 2; i < argc; i++) reweighting.add(histogram_run::read(argv[i]));
+        reweighting.solve();
+        std::cerr << "iterations " << reweighting.iterations << std::endl;
+        reweighting.write(std::cout, kbts);
+    } catch (const char * error) {
+        std::cerr << error << std::endl;
+        exit(1);
+    }
+}
@@ -0,0 +1,473 @@
+#ifndef SCENARIO_HPP
+#define SCENARIO_HPP
+
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "crystal.hpp"
+#include "monte_carlo.hpp"
+#include "axis_offsets.hpp"
+#include "bcc_offsets.hpp"
+#include "sc_offsets.hpp"
+#include "temperature_schedule.hpp"
+
+void configure_hertz(crystal * crystal, monte_carlo & monte_carlo, double kbt_eta, double rho_sigma3) {
+    crystal->potential_type = crystal::potential_type::HERTZ;
+    crystal->potential_epsilon = 1;
+    crystal->potential_sigma = pow(rho_sigma3 / crystal->density(), 1./3);
+    monte_carlo.beta = 1./(kbt_eta*crystal->potential_epsilon);
+    if (crystal->cutoff_tolerance > 0) crystal->fit_cutoff();
+    crystal->select_kernels();
+}
+
+void configure_star(crystal * crystal, monte_carlo & monte_carlo, double packing_fraction, double one_over_f) {
+    crystal->potential_type = crystal::potential_type::STAR;
+    crystal->potential_sigma = pow(M_PI / (6. * crystal->density() * packing_fraction), 1/3.);
+    crystal->potential_epsilon = 1. / one_over_f;
+    monte_carlo.beta = 1;
+    if (crystal->cutoff_tolerance > 0) crystal->fit_cutoff();
+    crystal->select_kernels();
+}
+
+/* offset measurement selected at runtime, wraps sc_offsets, bcc_offsets or axis_offsets */
+class measurement {
+    std::shared_ptr<void> impl;
+public:
+    std::function<void()> measure;
+    std::function<void(std::ostream &)> write;
+    std::function<std::vector<double>()> observables;
+    std::function<std::vector<const axis_offsets*>()> profiles;
+    template<typename T>
+    measurement(std::shared_ptr<T> m) : impl(m),
+        measure([m]() { m->measure(); }),
+        write([m](std::ostream & out) { m->write(out); }),
+        observables([m]() { return m->observables(); }),
+        profiles([m]() { return m->profiles(); }) { }
+};
+
+class scenario {
+    static std::vector<double> parse_list(const std::string & value) {
+        std::vector<double> ret;
+        std::istringstream s(value);
+        std::string item;
+        while (std::getline(s, item, ',')) ret.push_back(std::stod(item));
+        return ret;
+    }
+public:
+    enum lattice_kind { SIMPLE_CUBIC, FACE_CENTERED_CUBIC, BODY_CENTERED_CUBIC,
+        BODY_CENTERED_TETRAGONAL, HEXAGONAL, BODY_CENTERED_ORTHORHOMBIC, DIAMOND };
+    enum defect_kind { NO_DEFECT, INTERSTITIAL, VACANCY };
+    enum measurement_kind { SC_OFFSETS, BCC_OFFSETS, COLUMN_OFFSETS /* along n3 through mid */ };
+    enum visit_kind { UNIFORM_VISITS, DISTANCE_VISITS /* near defect cells */, AUTOCORRELATION_VISITS };
+
+    std::string name = "scenario";
+    std::string log_name = "offsets";
+
+    lattice_kind lattice = FACE_CENTERED_CUBIC;
+    double a = 3;
+    double b_over_a = 1;
+    double c_over_a = 1;
+    int n1 = 8, n2 = -1, n3 = -1;
+    double cutoff = 2; /* neighbour cells, the initial search range when cutoff_tolerance is set */
+    double cutoff_tolerance = 1e-6; /* fits the neighbour range to the potential, 0 keeps cutoff */
+
+    defect_kind defect = NO_DEFECT;
+    int mid[4] = {0, 0, 0, 0}; /* n1, n2, n3, basis of the defect cell */
+    vec3 offset = vec3(0.3, 0.3, 0.3); /* interstitial position */
+    double defect_concentration = 0; /* per cell in [0, 1], random defects of the same kind besides the one at mid */
+
+    enum crystal::potential_type potential = crystal::potential_type::HERTZ;
+    double kbt_eta = 0.002; /* hertz */
+    double rho_sigma3 = 1.8; /* hertz */
+    double packing_fraction = 1.25; /* star */
+    double one_over_f = 0.01; /* star */
+    bool wigner_seitz_constraint = true;
+
+    measurement_kind measurement_type = BCC_OFFSETS;
+    int nblocks = 100;
+    int nsweeps = 100; /* per block */
+    bool converge = false; /* stop before nblocks once the observables converged */
+    int min_blocks = 20;
+    double target_samples = 50; /* effective independent blocks per observable */
+    double target_error = 0; /* absolute error bar of the offset observables, 0 for none */
+    bool write_frames = true;
+    unsigned seed = 0;
+    int sample_every = 0; /* sweeps between structure samples, 0 disables them */
+    bool gr = true;
+    int gr_bins = 200;
+    double gr_r_max = 0; /* 0 reaches as far as the neighbour cells cover, crystal::pair_range() */
+    double sk_k_max = 0; /* 0 disables S(k) */
+    bool bond_order = false; /* steinhardt q4, q6, w6 */
+    double bond_order_r_cut = 0; /* 0 uses the bond_order_nearest closest neighbours */
+    int bond_order_nearest = 12;
+    bool fields = false; /* displacement and strain fields on the lattice grid and their transforms, every sample_every sweeps */
+    bool npt = false; /* isobaric box moves after every sweep */
+    double pressure = 0;
+    int box_moves = 1; /* per sweep */
+    double ln_v_max = 0.01;
+    bool shape_moves = true; /* independent box vector lengths */
+    bool morton = false; /* reorder cells and particles along a morton curve */
+    bool compact = false; /* quantised offsets, derived centres and per basis stencils, see crystal.hpp */
+    bool early_rejection = false; /* stop energy sums once a move is ruled out */
+    int tries = 1; /* candidates per move, more than 1 for multiple-try metropolis */
+    int proposal_block = 0; /* proposals drawn ahead per block of a pipelined sweep, 0 for plain sweeps */
+    int prefetch_distance = 2; /* moves between the prefetch stages of a pipelined sweep */
+    visit_kind visits = UNIFORM_VISITS; /* how moves are spread over the particles */
+    double visit_radius = 1; /* distance visits: around defect cells, in units of a */
+    double visit_boost = 10; /* weight of the boosted particles against the bulk, the maximum for autocorrelation */
+    int visit_sweeps = 200; /* autocorrelation visits: measured after every training */
+    double validate = energy_validation().fraction; /* of energy evaluations cross checked against all pairs */
+    int audit_every = 0; /* sweeps between full energy audits, 0 for none */
+    std::string live; /* shm name like /softspheres to publish snapshots to, empty disables */
+    double live_interval = 0.5; /* seconds */
+    bool schedule = false; /* temperature plateaus from kbt to kbt_to instead of one run */
+    enum temperature_schedule::kind schedule_type = temperature_schedule::LINEAR;
+    double kbt_to = 0.001;
+    int stages = 5; /* plateaus, the maximum for the adaptive schedule */
+    int ramp_sweeps = 100; /* between plateaus */
+    double energy_overlap = 1; /* adaptive: |dbeta| * stddev(E) per stage */
+    bool checkpoint = false; /* after every plateau */
+    int histogram = 0; /* sweeps between joint energy and offset samples, 0 disables */
+    std::vector<double> reweight_kbt; /* estimates at these kbt from the histograms */
+    bool relax = false; /* FIRE minimisation before the monte carlo run */
+    double relax_tolerance = 1e-6; /* residual force */
+    bool harmonic = false; /* harmonic prediction of the offset profiles before the run */
+    int free_energy = 0; /* frenkel ladd windows for the defect and perfect crystal before the run, at least 2, 0 disables */
+    int free_energy_blocks = 100; /* samples per window */
+    int free_energy_sweeps = 10; /* per sample */
+    double free_energy_spring = 0; /* 0 fits it to the perfect crystal */
+
+    lattice_definition unitcell() const {
+        switch (lattice) {
+            case SIMPLE_CUBIC: return lattice_definition::simple_cubic(a);
+            case FACE_CENTERED_CUBIC: return lattice_definition::face_centered_cubic(a);
+            case BODY_CENTERED_CUBIC: return lattice_definition::body_centered_cubic(a);
+            case BODY_CENTERED_TETRAGONAL: return lattice_definition::body_centered_tetragonal(a, c_over_a);
+            case HEXAGONAL: return lattice_definition::hexagonal(a, c_over_a);
+            case BODY_CENTERED_ORTHORHOMBIC: return lattice_definition::body_centered_orthorhombic(a, b_over_a, c_over_a);
+            case DIAMOND: return lattice_definition::diamond(a);
+        }
+        throw "unknown lattice";
+    }
+
+    /* scenarios with equal keys start from the same perfect crystal */
+    std::string prototype_key() const {
+        std::ostringstream s;
+        s << lattice << " " << a << " " << b_over_a << " " << c_over_a << " "
+          << n1 << " " << n2 << " " << n3 << " " << cutoff << " " << compact;
+        return s.str();
+    }
+
+    crystal * build() const {
+        auto cell = unitcell();
+        return crystal::build(cell, n1, n2, n3, cutoff, compact);
+    }
+
+    /* start of the temperature schedule, the star potential runs at kbt 1 */
+    double initial_kbt() const {
+        return potential == crystal::potential_type::HERTZ ? kbt_eta : 1;
+    }
+
+    /* configure the potential and insert the defect, crystal should be a perfect lattice */
+    lattice_cell * setup(crystal * crystal, monte_carlo & monte_carlo) const {
+        crystal->wigner_seitz_constraint = wigner_seitz_constraint;
+        crystal->cutoff_tolerance = cutoff_tolerance;
+        if (potential == crystal::potential_type::HERTZ) {
+            configure_hertz(crystal, monte_carlo, kbt_eta, rho_sigma3);
+        } else {
+            configure_star(crystal, monte_carlo, packing_fraction, one_over_f);
+        }
+        lattice_cell * cell = crystal->get_cell(mid[0], mid[1], mid[2], mid[3]);
+        if (defect != NO_DEFECT) {
+            /* the measured defect at mid, then random cells up to defect_concentration */
+            std::vector<lattice_cell*> sites = {cell};
+            if (!(defect_concentration >= 0 && defect_concentration <= 1)) throw "scenario: defect_concentration must be in [0, 1]";
+            size_t count = std::lround(defect_concentration * crystal->cells.size());
+            if (count > 1) {
+                for (lattice_cell * other : crystal->random_cells(count, monte_carlo.rng)) {
+                    if (other != cell && sites.size() < count) sites.push_back(other);
+                }
+            }
+            std::vector<crystal::defect_site> batch;
+            for (lattice_cell * site : sites) batch.emplace_back(site, defect == INTERSTITIAL, offset);
+            if (defect == INTERSTITIAL) crystal->reserve_particles(batch.size());
+            for (particle * in : crystal->insert_defects(batch)) {
+                if (crystal->wigner_seitz_constraint) {
+                    crystal->members(crystal->cell_of(in))[0]->color = 2;
+                    in->color = 2;
+                }
+            }
+        }
+        crystal->select_kernels();
+        return cell;
+    }
+
+    measurement make_measurement(crystal * crystal, lattice_cell * cell) const {
+        if (measurement_type == SC_OFFSETS) {
+            return measurement(std::make_shared<sc_offsets>(crystal, cell));
+        } else if (measurement_type == BCC_OFFSETS) {
+            return measurement(std::make_shared<bcc_offsets>(crystal, cell));
+        }
+        auto column = std::make_shared<axis_offsets>(crystal, vec3(0, 0, 1));
+        vec3 n = crystal->lattice_index(cell);
+        for (lattice_cell * lc : crystal->cells) {
+            vec3 m = crystal->lattice_index(lc);
+            if (m.x == n.x && m.y == n.y && crystal->basis(lc) == crystal->basis(cell)) {
+                for (particle * p : crystal->members(lc)) {
+                    column->add_particle(p);
+                }
+            }
+        }
+        return measurement(column);
+    }
+
+    /* space separated key=value list, eg.
+     * name=fcc lattice=fcc a=3 n=8 defect=interstitial mid=4,4,4,0 kbt=0.002 rho=1.8 */
+    static scenario parse(const std::string & spec) {
+        return parse(spec, scenario());
+    }
+
+    static scenario parse(const std::string & spec, scenario ret) {
+        std::istringstream s(spec);
+        std::string token;
+        while (s >> token) {
+            auto eq = token.find('=');
+            if (eq == std::string::npos) throw "scenario: expected key=value";
+            std::string key = token.substr(0, eq);
+            std::string value = token.substr(eq + 1);
+            if (key == "name") ret.name = value;
+            else if (key == "log") ret.log_name = value;
+            else if (key == "lattice") {
+                if (value == "sc") ret.lattice = SIMPLE_CUBIC;
+                else if (value == "fcc") ret.lattice = FACE_CENTERED_CUBIC;
+                else if (value == "bcc") ret.lattice = BODY_CENTERED_CUBIC;
+                else if (value == "bct") ret.lattice = BODY_CENTERED_TETRAGONAL;
+                else if (value == "hex") ret.lattice = HEXAGONAL;
+                else if (value == "bco") ret.lattice = BODY_CENTERED_ORTHORHOMBIC;
+                else if (value == "diamond") ret.lattice = DIAMOND;
+                else throw "scenario: unknown lattice";
+            }
+            else if (key == "a") ret.a = std::stod(value);
+            else if (key == "b_over_a") ret.b_over_a = std::stod(value);
+            else if (key == "c_over_a") ret.c_over_a = std::stod(value);
+            else if (key == "n") {
+                auto n = parse_list(value);
+                ret.n1 = n.at(0);
+                ret.n2 = n.size() > 1 ? n[1] : -1;
+                ret.n3 = n.size() > 2 ? n[2] : -1;
+            }
+            else if (key == "cutoff") ret.cutoff = std::stod(value);
+            else if (key == "cutoff_tolerance") ret.cutoff_tolerance = std::stod(value);
+            else if (key == "defect") {
+                if (value == "none") ret.defect = NO_DEFECT;
+                else if (value == "interstitial") ret.defect = INTERSTITIAL;
+                else if (value == "vacancy") ret.defect = VACANCY;
+                else throw "scenario: unknown defect";
+            }
+            else if (key == "defect_concentration") ret.defect_concentration = std::stod(value);
+            else if (key == "mid") {
+                auto n = parse_list(value);
+                for (size_t i = 0; i < 4; i++) ret.mid[i] = i < n.size() ? n[i] : 0;
+            }
+            else if (key == "offset") {
+                auto o = parse_list(value);
+                ret.offset = vec3(o.at(0), o.at(1), o.at(2));
+            }
+            else if (key == "potential") {
+                if (value == "hertz") ret.potential = crystal::potential_type::HERTZ;
+                else if (value == "star") ret.potential = crystal::potential_type::STAR;
+                else throw "scenario: unknown potential";
+            }
+            else if (key == "kbt") ret.kbt_eta = std::stod(value);
+            else if (key == "rho") ret.rho_sigma3 = std::stod(value);
+            else if (key == "packing_fraction") ret.packing_fraction = std::stod(value);
+            else if (key == "one_over_f") ret.one_over_f = std::stod(value);
+            else if (key == "ws") ret.wigner_seitz_constraint = std::stoi(value);
+            else if (key == "measure") {
+                if (value == "sc_offsets") ret.measurement_type = SC_OFFSETS;
+                else if (value == "bcc_offsets") ret.measurement_type = BCC_OFFSETS;
+                else if (value == "column_offsets") ret.measurement_type = COLUMN_OFFSETS;
+                else throw "scenario: unknown measurement";
+            }
+            else if (key == "blocks") ret.nblocks = std::stoi(value);
+            else if (key == "sweeps") ret.nsweeps = std::stoi(value);
+            else if (key == "converge") ret.converge = std::stoi(value);
+            else if (key == "min_blocks") ret.min_blocks = std::stoi(value);
+            else if (key == "target_samples") ret.target_samples = std::stod(value);
+            else if (key == "target_error") ret.target_error = std::stod(value);
+            else if (key == "frames") ret.write_frames = std::stoi(value);
+            else if (key == "seed") ret.seed = std::stoul(value);
+            else if (key == "sample_every") ret.sample_every = std::stoi(value);
+            else if (key == "gr") ret.gr = std::stoi(value);
+            else if (key == "gr_bins") ret.gr_bins = std::stoi(value);
+            else if (key == "gr_r_max") ret.gr_r_max = std::stod(value);
+            else if (key == "sk_k_max") ret.sk_k_max = std::stod(value);
+            else if (key == "bond_order") ret.bond_order = std::stoi(value);
+            else if (key == "bond_order_r_cut") ret.bond_order_r_cut = std::stod(value);
+            else if (key == "bond_order_nearest") ret.bond_order_nearest = std::stoi(value);
+            else if (key == "fields") ret.fields = std::stoi(value);
+            else if (key == "npt") ret.npt = std::stoi(value);
+            else if (key == "pressure") ret.pressure = std::stod(value);
+            else if (key == "box_moves") ret.box_moves = std::stoi(value);
+            else if (key == "ln_v_max") ret.ln_v_max = std::stod(value);
+            else if (key == "shape_moves") ret.shape_moves = std::stoi(value);
+            else if (key == "morton") ret.morton = std::stoi(value);
+            else if (key == "compact") ret.compact = std::stoi(value);
+            else if (key == "early_rejection") ret.early_rejection = std::stoi(value);
+            else if (key == "tries") ret.tries = std::stoi(value);
+            else if (key == "pipeline") ret.proposal_block = std::stoi(value);
+            else if (key == "prefetch_distance") ret.prefetch_distance = std::stoi(value);
+            else if (key == "visits") {
+                if (value == "uniform") ret.visits = UNIFORM_VISITS;
+                else if (value == "distance") ret.visits = DISTANCE_VISITS;
+                else if (value == "autocorrelation") ret.visits = AUTOCORRELATION_VISITS;
+                else throw "scenario: unknown visits";
+            }
+            else if (key == "visit_radius") ret.visit_radius = std::stod(value);
+            else if (key == "visit_boost") ret.visit_boost = std::stod(value);
+            else if (key == "visit_sweeps") ret.visit_sweeps = std::stoi(value);
+            else if (key == "validate") ret.validate = std::stod(value);
+            else if (key == "audit_every") ret.audit_every = std::stoi(value);
+            else if (key == "live") ret.live = value;
+            else if (key == "live_interval") ret.live_interval = std::stod(value);
+            else if (key == "schedule") {
+                ret.schedule = true;
+                if (value == "none") ret.schedule = false;
+                else if (value == "linear") ret.schedule_type = temperature_schedule::LINEAR;
+                else if (value == "geometric") ret.schedule_type = temperature_schedule::GEOMETRIC;
+                else if (value == "adaptive") ret.schedule_type = temperature_schedule::ADAPTIVE;
+                else throw "scenario: unknown schedule";
+            }
+            else if (key == "kbt_to") ret.kbt_to = std::stod(value);
+            else if (key == "stages") ret.stages = std::stoi(value);
+            else if (key == "ramp_sweeps") ret.ramp_sweeps = std::stoi(value);
+            else if (key == "energy_overlap") ret.energy_overlap = std::stod(value);
+            else if (key == "checkpoint") ret.checkpoint = std::stoi(value);
+            else if (key == "histogram") ret.histogram = std::stoi(value);
+            else if (key == "reweight_kbt") ret.reweight_kbt = parse_list(value);
+            else if (key == "relax") ret.relax = std::stoi(value);
+            else if (key == "relax_tolerance") ret.relax_tolerance = std::stod(value);
+            else if (key == "harmonic") ret.harmonic = std::stoi(value);
+            else if (key == "free_energy") ret.free_energy = std::stoi(value);
+            else if (key == "free_energy_blocks") ret.free_energy_blocks = std::stoi(value);
+            else if (key == "free_energy_sweeps") ret.free_energy_sweeps = std::stoi(value);
+            else if (key == "free_energy_spring") ret.free_energy_spring = std::stod(value);
+            else throw "scenario: unknown key";
+        }
+        return ret;
+    }
+
+    /* like parse, but the spec may start with a builtin scenario name and
+     * kbt and rho may be comma separated lists spanning a grid, eg.
+     * hertz_fcc_int kbt=0.001,0.002,0.003 rho=1.8,2.0 */
+    static std::vector<scenario> parse_grid(const std::string & spec) {
+        std::istringstream s(spec);
+        std::string token, rest;
+        std::vector<double> kbts, rhos;
+        scenario base;
+        bool first = true;
+        while (s >> token) {
+            if (first && token.find('=') == std::string::npos) {
+                if (!builtin(token, base)) throw "scenario: unknown builtin";
+            } else if (token.rfind("kbt=", 0) == 0) {
+                kbts = parse_list(token.substr(4));
+            } else if (token.rfind("rho=", 0) == 0) {
+                rhos = parse_list(token.substr(4));
+            } else {
+                rest += token + " ";
+            }
+            first = false;
+        }
+        scenario ret = parse(rest, base);
+        if (kbts.size() <= 1 && rhos.size() <= 1) {
+            if (!kbts.empty()) ret.kbt_eta = kbts[0];
+            if (!rhos.empty()) ret.rho_sigma3 = rhos[0];
+            return {ret};
+        }
+        if (kbts.empty()) kbts.push_back(ret.kbt_eta);
+        if (rhos.empty()) rhos.push_back(ret.rho_sigma3);
+        return ret.grid(kbts, rhos);
+    }
+
+    /* the scenarios that used to be selected with #define in main.cpp */
+
+    static scenario hertz_sc_vac() {
+        return parse("name=hertz_sc_vac log=sc_offsets lattice=sc a=3 n=10 defect=vacancy mid=5,5,5,0 "
+                "kbt=0.001 rho=5.2 measure=sc_offsets");
+    }
+
+    static scenario hertz_bcc_int() {
+        return parse("name=hertz_bcc_int log=bcc_offsets lattice=bcc a=3 n=7 defect=interstitial mid=4,4,4,0 "
+                "kbt=0.002 rho=2.5 measure=bcc_offsets");
+    }
+
+    static scenario hertz_fcc_int() {
+        return parse("name=hertz_fcc_int log=fcc_offsets lattice=fcc a=3 n=8 defect=interstitial mid=4,4,4,0 "
+                "kbt=0.002 rho=1.8 measure=bcc_offsets");
+    }
+
+    static scenario hertz_hex_vac() {
+        return parse("name=hertz_hex_vac log=hex_offsets lattice=hex a=3 c_over_a=0.84 n=6,6,20 defect=vacancy "
+                "mid=3,3,5,0 kbt=0.001 rho=4.0 measure=column_offsets");
+    }
+
+    static scenario star_test() {
+        return parse("name=star_test log=bcc_offsets lattice=bcc a=3 n=4 cutoff=10 potential=star "
+                "packing_fraction=1.25 one_over_f=0.01 ws=0 measure=bcc_offsets");
+    }
+
+    /* compresses the box a lot in a few sweeps with a full audit after
+     * every sweep, the validation file should show no mismatches */
+    static scenario npt_test() {
+        return parse("name=npt_test log=fcc_offsets lattice=fcc a=3 n=4 defect=interstitial mid=2,2,2,0 "
+                "kbt=0.002 rho=1.8 measure=bcc_offsets npt=1 pressure=50 ln_v_max=0.05 box_moves=5 "
+                "blocks=3 sweeps=20 audit_every=1 validate=0.05");
+    }
+
+    /* dilute lattices whose pair cutoff falls short of the wigner seitz
+     * faces, fit_cutoff has to keep the face neighbours in the lists.
+     * debug builds assert that the lists cut out the cells to 1e-9 */
+    static scenario ws_fcc_test() {
+        return parse("name=ws_fcc_test log=fcc_offsets lattice=fcc a=3 n=4 defect=interstitial mid=2,2,2,0 "
+                "kbt=0.002 rho=0.1 measure=bcc_offsets blocks=3 sweeps=20 audit_every=1 validate=0.05");
+    }
+
+    static scenario ws_bcc_test() {
+        return parse("name=ws_bcc_test log=bcc_offsets lattice=bcc a=3 n=4 defect=interstitial mid=2,2,2,0 "
+                "kbt=0.002 rho=0.1 measure=bcc_offsets blocks=3 sweeps=20 audit_every=1 validate=0.05");
+    }
+
+    static bool builtin(const std::string & name, scenario & ret) {
+        if (name == "hertz_sc_vac") ret = hertz_sc_vac();
+        else if (name == "hertz_bcc_int") ret = hertz_bcc_int();
+        else if (name == "hertz_fcc_int") ret = hertz_fcc_int();
+        else if (name == "hertz_hex_vac") ret = hertz_hex_vac();
+        else if (name == "star_test") ret = star_test();
+        else if (name == "npt_test") ret = npt_test();
+        else if (name == "ws_fcc_test") ret = ws_fcc_test();
+        else if (name == "ws_bcc_test") ret = ws_bcc_test();
+        else return false;
+        return true;
+    }
+
+    /* one scenario per (kBT, rho sigma^3) point, hertz only */
+    std::vector<scenario> grid(const std::vector<double> & kbts, const std::vector<double> & rhos) const {
+        std::vector<scenario> ret;
+        for (double kbt : kbts) {
+            for (double rho : rhos) {
+                scenario s = *this;
+                s.kbt_eta = kbt;
+                s.rho_sigma3 = rho;
+                std::ostringstream n;
+                n << name << "_kbt" << kbt << "_rho" << rho;
+                s.name = n.str();
+                ret.push_back(s);
+            }
+        }
+        return ret;
+    }
+};
+
+#endif
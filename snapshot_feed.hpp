@@ -0,0 +1,214 @@
+#ifndef SNAPSHOT_FEED_HPP
+#define SNAPSHOT_FEED_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crystal.hpp"
+
+/* live snapshots in POSIX shared memory: a ring of frames, each guarded
+ * by a seqlock, so the publishing monte carlo thread never waits for a
+ * reader and a reader retries when it raced with a write.
+ *
+ * layout: snapshot_header, then depth frames of
+ *   snapshot_frame_header, snapshot_particle[capacity] */
+
+struct snapshot_header {
+    char magic[8]; /* "SNAPFEED" */
+    uint32_t version;
+    uint32_t depth; /* frames in the ring */
+    uint32_t capacity; /* particles per frame */
+    uint32_t padding;
+    uint64_t frame_bytes;
+    std::atomic<uint64_t> latest; /* number of published frames */
+};
+
+struct snapshot_frame_header {
+    std::atomic<uint64_t> sequence; /* odd while being written */
+    uint64_t index;
+    uint32_t nparticles;
+    uint32_t padding;
+    double box[9]; /* p1, p2, p3 */
+};
+
+struct snapshot_particle {
+    float x, y, z;
+    int16_t color;
+    int16_t size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs address free atomics");
+
+class snapshot_feed {
+protected:
+    std::string name;
+    int fd = -1;
+    void * base = nullptr;
+    size_t bytes = 0;
+
+    snapshot_header * header() const { return (snapshot_header*)base; }
+    static size_t frame_bytes(uint32_t capacity) {
+        size_t b = sizeof(snapshot_frame_header) + capacity * sizeof(snapshot_particle);
+        return (b + 63) / 64 * 64;
+    }
+    snapshot_frame_header * frame(uint64_t index) const {
+        return (snapshot_frame_header*)((char*)base + sizeof(snapshot_header) + 64
+                + (index % header()->depth) * header()->frame_bytes);
+    }
+    snapshot_particle * frame_particles(snapshot_frame_header * f) const {
+        return (snapshot_particle*)(f + 1);
+    }
+
+public:
+    snapshot_feed() { }
+    snapshot_feed(const snapshot_feed &) = delete;
+    snapshot_feed & operator=(const snapshot_feed &) = delete;
+    virtual ~snapshot_feed() {
+        if (base) munmap(base, bytes);
+        if (fd >= 0) close(fd);
+    }
+};
+
+class snapshot_publisher : public snapshot_feed {
+    std::chrono::steady_clock::time_point last;
+public:
+    double interval; /* seconds between published frames */
+
+    /* name is a shm object name like "/softspheres" */
+    snapshot_publisher(const std::string & name, uint32_t capacity, uint32_t depth=4, double interval=0.1) :
+        interval(interval) {
+        this->name = name;
+        bytes = sizeof(snapshot_header) + 64 + depth * frame_bytes(capacity);
+        fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0) throw "snapshot_publisher: shm_open failed";
+        if (ftruncate(fd, bytes) != 0) throw "snapshot_publisher: ftruncate failed";
+        base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) { base = nullptr; throw "snapshot_publisher: mmap failed"; }
+        memset(base, 0, bytes);
+        snapshot_header * h = header();
+        h->version = 1;
+        h->depth = depth;
+        h->capacity = capacity;
+        h->frame_bytes = frame_bytes(capacity);
+        h->latest.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(h->magic, "SNAPFEED", 8);
+        last = std::chrono::steady_clock::now() - std::chrono::hours(1);
+    }
+
+    ~snapshot_publisher() {
+        shm_unlink(name.c_str());
+    }
+
+    /* publishes when interval has passed since the last frame, returns whether it did */
+    bool maybe_publish(const crystal & c) {
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last).count() < interval) return false;
+        last = now;
+        publish(c);
+        return true;
+    }
+
+    void publish(const crystal & c) {
+        snapshot_header * h = header();
+        uint64_t index = h->latest.load(std::memory_order_relaxed);
+        snapshot_frame_header * f = frame(index);
+        uint64_t sequence = f->sequence.load(std::memory_order_relaxed);
+        f->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        size_t n = std::min<size_t>(c.particles.size(), h->capacity);
+        f->index = index;
+        f->nparticles = n;
+        vec3 p[3] = {c.space.p1(), c.space.p2(), c.space.p3()};
+        for (int i = 0; i < 3; i++) {
+            f->box[3*i] = p[i].x;
+            f->box[3*i + 1] = p[i].y;
+            f->box[3*i + 2] = p[i].z;
+        }
+        snapshot_particle * out = frame_particles(f);
+        for (size_t i = 0; i < n; i++) {
+            const particle * q = c.particles[i];
+            vec3 x = c.position(q);
+            out[i] = {(float)x.x, (float)x.y, (float)x.z, q->color, q->size};
+        }
+        f->sequence.store(sequence + 2, std::memory_order_release);
+        h->latest.store(index + 1, std::memory_order_release);
+    }
+};
+
+class snapshot_subscriber : public snapshot_feed {
+public:
+    struct snapshot {
+        uint64_t index;
+        vec3 p1, p2, p3;
+        std::vector<snapshot_particle> particles;
+    };
+
+    snapshot_subscriber(const std::string & name) {
+        this->name = name;
+        fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) throw "snapshot_subscriber: shm_open failed";
+        struct stat st;
+        if (fstat(fd, &st) != 0) throw "snapshot_subscriber: fstat failed";
+        bytes = st.st_size;
+        base = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) { base = nullptr; throw "snapshot_subscriber: mmap failed"; }
+        if (memcmp(header()->magic, "SNAPFEED", 8) != 0) throw "snapshot_subscriber: not a snapshot feed";
+    }
+
+    uint64_t published() const {
+        return header()->latest.load(std::memory_order_acquire);
+    }
+
+    /* copies the most recent consistent frame, false if none was published
+     * yet or the writer kept racing us */
+    bool latest(snapshot & out, int retries=1000) const {
+        for (int attempt = 0; attempt < retries; attempt++) {
+            uint64_t count = published();
+            if (count == 0) return false;
+            snapshot_frame_header * f = frame(count - 1);
+            uint64_t s1 = f->sequence.load(std::memory_order_acquire);
+            if (s1 % 2) continue;
+            out.index = f->index;
+            out.p1 = vec3(f->box[0], f->box[1], f->box[2]);
+            out.p2 = vec3(f->box[3], f->box[4], f->box[5]);
+            out.p3 = vec3(f->box[6], f->box[7], f->box[8]);
+            uint32_t n = std::min(f->nparticles, header()->capacity);
+            out.particles.resize(n);
+            memcpy(out.particles.data(), frame_particles(f), n * sizeof(snapshot_particle));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t s2 = f->sequence.load(std::memory_order_relaxed);
+            if (s1 == s2 && out.index == count - 1) return true;
+        }
+        return false;
+    }
+
+    /* same format as crystal::write, for opengl-mol */
+    static void write(const snapshot & s, std::ostream & out) {
+        out << s.particles.size() << "\n";
+        out << "0 0 0" << "\n";
+        out << s.p1.x << " " << s.p1.y << " " << s.p1.z << "\n";
+        out << s.p2.x << " " << s.p2.y << " " << s.p2.z << "\n";
+        out << s.p3.x << " " << s.p3.y << " " << s.p3.z << "\n";
+        for (const auto & p : s.particles) {
+            out << p.x << " "
+                << p.y << " "
+                << p.z << " "
+                << p.size << " "
+                << p.color << " "
+                << "\n";
+        }
+        out << std::flush;
+    }
+};
+
+#endif
@@ -0,0 +1,42 @@
+// BUILD g++ snapshot_reader.cpp -O2 -Wall -std=c++17 -o snapshot_reader
+
+/* reads the live feed a run publishes with live=/name and converts
+ * frames to the opengl.NNNN text format on demand:
+ *   snapshot_reader /name dir           latest frame only
+ *   snapshot_reader /name dir 0.5       every new frame, polling twice a second */
+
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#define PRINT_VAR(x) std::cout << #x" => " << (x) << std::endl
+
+#include "snapshot_feed.hpp"
+
+int main(int argc, char ** argv) {
+    if (argc != 3 && argc != 4) {
+        std::cerr << "usage: snapshot_reader [shm name] [output directory] [poll seconds]" << std::endl;
+        exit(1);
+    }
+    std::string dir = argv[2];
+    double poll = argc == 4 ? std::stod(argv[3]) : -1;
+    try {
+        snapshot_subscriber feed(argv[1]);
+        snapshot_subscriber::snapshot s;
+        uint64_t written = 0;
+        do {
+            if (feed.published() != written && feed.latest(s)) {
+                written = s.index + 1;
+                std::ostringstream fn;
+                fn << dir << "/opengl." << std::setfill('0') << std::setw(4) << s.index;
+                std::ofstream out(fn.str());
+                snapshot_subscriber::write(s, out);
+                std::cout << fn.str() << std::endl;
+            }
+            if (poll > 0) std::this_thread::sleep_for(std::chrono::duration<double>(poll));
+        } while (poll > 0);
+    } catch (const char * error) {
+        std::cerr << error << std::endl;
+        exit(1);
+    }
+}
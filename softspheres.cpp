@@ -0,0 +1,440 @@
+// BUILD c++ -O3 -Wall -shared -std=c++17 -fPIC $(python3 -m pybind11 --includes) softspheres.cpp -o softspheres$(python3-config --extension-suffix) -lpthread
+
+/* python bindings, eg.
+ *
+ *   import softspheres as ss
+ *   c = ss.crystal.build(ss.lattice_definition.face_centered_cubic(3), 8)
+ *   mc = ss.monte_carlo(c, 0)
+ *   ss.configure_hertz(c, mc, 0.002, 1.8)
+ *   mid = c.get_cell(4, 4, 4, 0)
+ *   c.interstitial(mid, ss.vec3(0.3, 0.3, 0.3))
+ *   offsets = ss.bcc_offsets(c, mid)
+ *   pos = c.positions()              # (slots, 3) view of engine memory
+ *   alive = c.particle_slot_indices()
+ *   mc.train(); mc.sweep_sym(100)
+ *   offsets.measure(); print(offsets)
+ *   pos[alive]                       # reflects the sweeps without copying back
+ *
+ * views cover the slot storage of the crystal, released slots (vacancies)
+ * stay in it. after inserting interstitials the slot count may grow, so
+ * fetch the views again. compact crystals store no positions or centres,
+ * positions() and cell_centers() return decoded copies for them */
+
+#define NDEBUG
+
+#include <sstream>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#define PRINT_VAR(x) std::cout << #x" => " << (x) << std::endl
+
+#include "crystal.hpp"
+#include "monte_carlo.hpp"
+#include "axis_offsets.hpp"
+#include "bcc_offsets.hpp"
+#include "sc_offsets.hpp"
+#include "scenario.hpp"
+#include "fire_minimizer.hpp"
+#include "temperature_schedule.hpp"
+#include "convergence.hpp"
+#include "histogram_reweighting.hpp"
+#include "lattice_dynamics.hpp"
+#include "visit_schedule.hpp"
+#include "thermodynamic_integration.hpp"
+#include "displacement_field.hpp"
+
+namespace py = pybind11;
+
+template<typename T, typename Slot>
+py::array_t<T> slot_view(py::handle owner, Slot * slots, size_t nslots, const T * first, size_t ncols) {
+    /* strided view over one member of an array of structs */
+    ssize_t stride = sizeof(Slot);
+    if (ncols == 1) {
+        return py::array_t<T>({(ssize_t)nslots}, {stride}, first, owner);
+    }
+    return py::array_t<T>({(ssize_t)nslots, (ssize_t)ncols}, {stride, (ssize_t)sizeof(T)}, first, owner);
+}
+
+template<typename T>
+std::string to_string(const T & value) {
+    std::ostringstream s;
+    value.write(s);
+    return s.str();
+}
+
+PYBIND11_MODULE(softspheres, m) {
+    py::class_<vec3>(m, "vec3")
+        .def(py::init<>())
+        .def(py::init<double, double, double>())
+        .def_readwrite("x", &vec3::x)
+        .def_readwrite("y", &vec3::y)
+        .def_readwrite("z", &vec3::z)
+        .def("__repr__", [](const vec3 & v) { std::ostringstream s; s << v; return s.str(); });
+
+    py::class_<lattice_definition>(m, "lattice_definition")
+        .def_readwrite("a", &lattice_definition::a)
+        .def_readwrite("b", &lattice_definition::b)
+        .def_readwrite("c", &lattice_definition::c)
+        .def_readwrite("basis_vectors", &lattice_definition::basis_vectors)
+        .def("volume", &lattice_definition::volume)
+        .def_static("simple_cubic", &lattice_definition::simple_cubic, py::arg("a")=1)
+        .def_static("face_centered_cubic", &lattice_definition::face_centered_cubic, py::arg("a")=1)
+        .def_static("body_centered_cubic", &lattice_definition::body_centered_cubic, py::arg("a")=1)
+        .def_static("body_centered_tetragonal", &lattice_definition::body_centered_tetragonal)
+        .def_static("hexagonal", &lattice_definition::hexagonal)
+        .def_static("body_centered_orthorhombic", &lattice_definition::body_centered_orthorhombic)
+        .def_static("diamond", &lattice_definition::diamond);
+
+    /* positions, cells and centres are kept by the crystal, see its
+     * position(), cell_of() and center() */
+    py::class_<particle>(m, "particle")
+        .def_readonly("id", &particle::id)
+        .def_readwrite("color", &particle::color)
+        .def_readwrite("size", &particle::size);
+
+    py::class_<lattice_cell>(m, "lattice_cell");
+
+    py::class_<crystal> pycrystal(m, "crystal");
+    py::class_<crystal::defect_site>(pycrystal, "defect_site")
+        .def(py::init<lattice_cell*, bool, vec3, int>(), py::arg("cell"), py::arg("interstitial"),
+                py::arg("offset")=vec3(), py::arg("basis")=0)
+        .def_readwrite("cell", &crystal::defect_site::cell)
+        .def_readwrite("interstitial", &crystal::defect_site::interstitial)
+        .def_readwrite("offset", &crystal::defect_site::offset)
+        .def_readwrite("basis", &crystal::defect_site::basis);
+    py::enum_<enum crystal::potential_type>(pycrystal, "potential_type")
+        .value("STAR", crystal::potential_type::STAR)
+        .value("HERTZ", crystal::potential_type::HERTZ);
+    pycrystal
+        .def_static("build", &crystal::build, py::arg("unitcell"), py::arg("n1")=4, py::arg("n2")=-1,
+                py::arg("n3")=-1, py::arg("cutoff")=2, py::arg("compact")=false, py::return_value_policy::take_ownership)
+        .def_property_readonly("compact", &crystal::compact_storage)
+        .def("memory", &crystal::memory, "bytes per component")
+        .def("clone", &crystal::clone, py::return_value_policy::take_ownership)
+        /* the potential is set through configure_hertz and configure_star,
+         * which fit the cutoff and select the kernels along */
+        .def_readonly("potential_type", &crystal::potential_type)
+        .def_readonly("potential_sigma", &crystal::potential_sigma)
+        .def_readonly("potential_epsilon", &crystal::potential_epsilon)
+        .def_property("wigner_seitz_constraint",
+                [](const crystal & c) { return (bool)c.wigner_seitz_constraint; },
+                [](crystal & c, bool ws) { c.wigner_seitz_constraint = ws; c.select_kernels(); })
+        .def("select_kernels", &crystal::select_kernels)
+        .def_readwrite("cutoff_tolerance", &crystal::cutoff_tolerance)
+        .def_readonly("potential_cutoff", &crystal::potential_cutoff)
+        .def_readonly("potential_shift", &crystal::potential_shift)
+        .def_readonly("displacement_skin", &crystal::displacement_skin)
+        .def_readonly("neighbour_range", &crystal::neighbour_range)
+        .def("fit_cutoff", &crystal::fit_cutoff)
+        .def_readonly("last_cutoff_fit", &crystal::last_cutoff_fit)
+        .def("pair_range", &crystal::pair_range)
+        .def("cover_all", &crystal::cover_all, "has to be called after moving particles through the views")
+        .def("tail_energy", &crystal::tail_energy)
+        .def("reorder_morton", &crystal::reorder_morton, "invalidates views and held particles and cells")
+        .def("reserve_particles", &crystal::reserve_particles, py::arg("count"), "invalidates views and held particles")
+        .def("potential", &crystal::potential)
+        .def("total_energy", &crystal::total_energy)
+        .def_property_readonly("validation", [](crystal & c) { return &c.validation; }, py::return_value_policy::reference_internal)
+        .def("audit", &crystal::audit, py::arg("sweep")=-1, "full energy audit against all pairs, returns the mismatches")
+        .def("density", &crystal::density)
+        .def("get_cell", &crystal::get_cell, py::return_value_policy::reference_internal)
+        .def("cell_of", &crystal::cell_of, py::return_value_policy::reference_internal)
+        .def("members", [](const crystal & c, const lattice_cell * cell) {
+            std::vector<particle*> ret;
+            for (particle * p : c.members(cell)) ret.push_back(p);
+            return ret;
+        }, py::return_value_policy::reference_internal)
+        .def("lattice_index", &crystal::lattice_index)
+        .def("basis", &crystal::basis)
+        .def("center", &crystal::center)
+        .def("contains", &crystal::contains)
+        .def("position", &crystal::position)
+        .def("offset", &crystal::offset, "from the centre of its cell")
+        .def("place", &crystal::place, "call cover_all before the next energy")
+        .def("energy", &crystal::particle_energy, py::arg("particle"), py::arg("shift")=vec3())
+        .def("interstitial", &crystal::interstitial, py::return_value_policy::reference_internal)
+        .def("vacancy", &crystal::vacancy, py::arg("cell"), py::arg("basis")=0)
+        .def("insert_defects", &crystal::insert_defects, py::return_value_policy::reference_internal,
+                "vacancies and interstitials in one pass, returns the new interstitials")
+        .def("random_cells", [](const crystal & c, size_t count, unsigned seed) {
+            std::mt19937 rng(seed);
+            return c.random_cells(count, rng);
+        }, py::return_value_policy::reference_internal, py::arg("count"), py::arg("seed")=0)
+        .def("__len__", [](const crystal & c) { return c.particles.size(); })
+        .def("write", py::overload_cast<const std::string &>(&crystal::write, py::const_))
+        .def("positions", [](py::object self) {
+            crystal & c = self.cast<crystal &>();
+            if (vec3 * slots = c.position_slots()) {
+                return slot_view<double>(self, slots, c.particle_slot_count(), &slots->x, 3);
+            }
+            /* released slots are nan */
+            py::array_t<double> ret({(ssize_t)c.particle_slot_count(), (ssize_t)3});
+            auto r = ret.mutable_unchecked<2>();
+            for (size_t i = 0; i < c.particle_slot_count(); i++) {
+                const particle * p = c.particle_slots() + i;
+                vec3 x = p->cell == particle::none ? vec3(NAN, NAN, NAN) : c.position(p);
+                r(i, 0) = x.x, r(i, 1) = x.y, r(i, 2) = x.z;
+            }
+            return ret;
+        }, "(slots, 3) view of the particle positions, a copy for compact crystals")
+        .def("colors", [](py::object self) {
+            crystal & c = self.cast<crystal &>();
+            particle * slots = c.particle_slots();
+            return slot_view<int16_t>(self, slots, c.particle_slot_count(), &slots->color, 1);
+        })
+        .def("sizes", [](py::object self) {
+            crystal & c = self.cast<crystal &>();
+            particle * slots = c.particle_slots();
+            return slot_view<int16_t>(self, slots, c.particle_slot_count(), &slots->size, 1);
+        })
+        .def("cell_centers", [](py::object self) {
+            crystal & c = self.cast<crystal &>();
+            if (vec3 * slots = c.center_slots()) {
+                return slot_view<double>(self, slots, c.cell_slot_count(), &slots->x, 3);
+            }
+            py::array_t<double> ret({(ssize_t)c.cell_slot_count(), (ssize_t)3});
+            auto r = ret.mutable_unchecked<2>();
+            for (size_t i = 0; i < c.cell_slot_count(); i++) {
+                vec3 x = c.center(c.cell_slots() + i);
+                r(i, 0) = x.x, r(i, 1) = x.y, r(i, 2) = x.z;
+            }
+            return ret;
+        }, "(cells, 3) view of the wigner seitz cell centres, a copy for compact crystals")
+        .def("particle_slot_indices", [](crystal & c) {
+            /* slot of every live particle, in crystal.particles order */
+            py::array_t<int64_t> ret(c.particles.size());
+            auto r = ret.mutable_unchecked<1>();
+            for (size_t i = 0; i < c.particles.size(); i++) r(i) = c.particles[i] - c.particle_slots();
+            return ret;
+        })
+        .def("cell_slot_indices", [](crystal & c) {
+            /* slot of the cell of every live particle, in crystal.particles order */
+            py::array_t<int64_t> ret(c.particles.size());
+            auto r = ret.mutable_unchecked<1>();
+            for (size_t i = 0; i < c.particles.size(); i++) r(i) = c.particles[i]->cell;
+            return ret;
+        });
+
+    py::class_<crystal::cutoff_fit>(m, "cutoff_fit")
+        .def_readonly("cutoff", &crystal::cutoff_fit::cutoff)
+        .def_readonly("shift", &crystal::cutoff_fit::shift)
+        .def_readonly("truncation_error", &crystal::cutoff_fit::truncation_error)
+        .def_readonly("wigner_seitz_radius", &crystal::cutoff_fit::wigner_seitz_radius)
+        .def_readonly("face_distance", &crystal::cutoff_fit::face_distance)
+        .def_readonly("displacement_skin", &crystal::cutoff_fit::displacement_skin)
+        .def_readonly("neighbour_range", &crystal::cutoff_fit::neighbour_range)
+        .def_readonly("neighbour_cells", &crystal::cutoff_fit::neighbour_cells);
+
+    py::class_<crystal::memory_usage>(m, "memory_usage")
+        .def_readonly("particles", &crystal::memory_usage::particles)
+        .def_readonly("positions", &crystal::memory_usage::positions)
+        .def_readonly("cells", &crystal::memory_usage::cells)
+        .def_readonly("lattice", &crystal::memory_usage::lattice)
+        .def_readonly("neighbour_lists", &crystal::memory_usage::neighbour_lists)
+        .def_readonly("stencils", &crystal::memory_usage::stencils)
+        .def_readonly("indices", &crystal::memory_usage::indices)
+        .def_readonly("total", &crystal::memory_usage::total)
+        .def_readonly("sites", &crystal::memory_usage::sites);
+
+    py::class_<energy_validation>(m, "energy_validation")
+        .def_readwrite("fraction", &energy_validation::fraction)
+        .def_readwrite("tolerance", &energy_validation::tolerance)
+        .def_readwrite("audit_every", &energy_validation::audit_every)
+        .def_readwrite("abort_on_mismatch", &energy_validation::abort_on_mismatch)
+        .def("seed", &energy_validation::seed)
+        .def_readonly("checks", &energy_validation::checks)
+        .def_readonly("audits", &energy_validation::audits)
+        .def_readonly("mismatches", &energy_validation::mismatches)
+        .def_readonly("worst", &energy_validation::worst);
+
+    py::class_<visit_schedule>(m, "visit_schedule")
+        .def("set", &visit_schedule::set)
+        .def("clear", &visit_schedule::clear)
+        .def_readonly("weights", &visit_schedule::weights)
+        .def_static("by_distance", &visit_schedule::by_distance)
+        .def_static("by_autocorrelation", &visit_schedule::by_autocorrelation);
+
+    py::class_<monte_carlo>(m, "monte_carlo")
+        .def(py::init<crystal *, unsigned>(), py::arg("crystal"), py::arg("seed")=0, py::keep_alive<1, 2>())
+        .def_readwrite("r_max", &monte_carlo::r_max)
+        .def_readwrite("beta", &monte_carlo::beta)
+        .def_readwrite("early_rejection", &monte_carlo::early_rejection)
+        .def_readwrite("tries", &monte_carlo::tries)
+        .def_readwrite("proposal_block", &monte_carlo::proposal_block)
+        .def_readwrite("prefetch_distance", &monte_carlo::prefetch_distance)
+        .def_readonly("sweeps_done", &monte_carlo::sweeps_done)
+        .def_readwrite("visits", &monte_carlo::visits)
+        .def_readwrite("lambda_", &monte_carlo::lambda, "frenkel ladd coupling of the pair energy")
+        .def_readwrite("spring", &monte_carlo::spring)
+        .def("offset_autocorrelation", &monte_carlo::offset_autocorrelation, py::arg("sweeps"), py::arg("sym")=true,
+                py::call_guard<py::gil_scoped_release>())
+        .def("sweep_sym", &monte_carlo::sweep_sym, py::arg("times")=1, py::call_guard<py::gil_scoped_release>())
+        .def("sweep_1p", &monte_carlo::sweep_1p, py::arg("times")=1, py::call_guard<py::gil_scoped_release>())
+        .def("train", &monte_carlo::train, py::arg("sym")=true, py::arg("pacc_goal")=0.3, py::arg("r_from")=0.0001,
+                py::arg("r_to")=3, py::arg("width")=50, py::arg("height")=3, py::arg("nsweeps")=5,
+                py::call_guard<py::gil_scoped_release>());
+
+    py::class_<displacement_field>(m, "displacement_field")
+        .def(py::init<crystal *, const lattice_cell *, unsigned>(), py::arg("crystal"), py::arg("origin")=nullptr,
+                py::arg("nthreads")=0, py::keep_alive<1, 2>())
+        .def("measure", &displacement_field::measure, py::call_guard<py::gil_scoped_release>())
+        .def("write", &displacement_field::write)
+        .def_readonly("nsamples", &displacement_field::nsamples);
+
+    py::class_<thermodynamic_integration> pyintegration(m, "thermodynamic_integration");
+    py::class_<thermodynamic_integration::window>(pyintegration, "window")
+        .def_readonly("lambda_", &thermodynamic_integration::window::lambda)
+        .def_readonly("weight", &thermodynamic_integration::window::weight)
+        .def_readonly("mean", &thermodynamic_integration::window::mean)
+        .def_readonly("error", &thermodynamic_integration::window::error)
+        .def_readonly("tau", &thermodynamic_integration::window::tau)
+        .def_readonly("r_max", &thermodynamic_integration::window::r_max);
+    py::class_<thermodynamic_integration::result>(pyintegration, "result")
+        .def_readonly("particles", &thermodynamic_integration::result::particles)
+        .def_readonly("spring", &thermodynamic_integration::result::spring)
+        .def_readonly("einstein", &thermodynamic_integration::result::einstein)
+        .def_readonly("offset", &thermodynamic_integration::result::offset)
+        .def_readonly("integral", &thermodynamic_integration::result::integral)
+        .def_readonly("integral_error", &thermodynamic_integration::result::integral_error)
+        .def_readonly("coarse_integral", &thermodynamic_integration::result::coarse_integral)
+        .def_readonly("quadrature_error", &thermodynamic_integration::result::quadrature_error)
+        .def_readonly("wall_error", &thermodynamic_integration::result::wall_error)
+        .def_readonly("free_energy", &thermodynamic_integration::result::free_energy)
+        .def_readonly("error", &thermodynamic_integration::result::error)
+        .def_readonly("windows", &thermodynamic_integration::result::windows)
+        .def_readonly("coarse", &thermodynamic_integration::result::coarse);
+    pyintegration
+        .def(py::init<int>(), py::arg("windows")=8)
+        .def_readwrite("windows", &thermodynamic_integration::windows)
+        .def_readwrite("equilibration_sweeps", &thermodynamic_integration::equilibration_sweeps)
+        .def_readwrite("blocks", &thermodynamic_integration::blocks)
+        .def_readwrite("sweeps", &thermodynamic_integration::sweeps)
+        .def_readwrite("spring", &thermodynamic_integration::spring)
+        .def_readwrite("nthreads", &thermodynamic_integration::nthreads)
+        .def_readwrite("seed", &thermodynamic_integration::seed)
+        .def("fit_spring", &thermodynamic_integration::fit_spring, py::arg("crystal"), py::arg("beta"), py::arg("nsweeps")=200,
+                py::call_guard<py::gil_scoped_release>())
+        .def("run", &thermodynamic_integration::run, py::call_guard<py::gil_scoped_release>());
+
+    m.def("configure_hertz", &configure_hertz);
+    m.def("configure_star", &configure_star);
+    m.def("set_temperature", &set_temperature);
+    m.def("write_checkpoint", &write_checkpoint);
+    m.def("read_checkpoint", &read_checkpoint);
+
+    py::class_<temperature_schedule> pyschedule(m, "temperature_schedule");
+    py::enum_<temperature_schedule::kind>(pyschedule, "kind")
+        .value("LINEAR", temperature_schedule::LINEAR)
+        .value("GEOMETRIC", temperature_schedule::GEOMETRIC)
+        .value("ADAPTIVE", temperature_schedule::ADAPTIVE);
+    pyschedule
+        .def(py::init<temperature_schedule::kind, double, double, int>(),
+                py::arg("type"), py::arg("kbt_from"), py::arg("kbt_to"), py::arg("nstages")=5)
+        .def_readwrite("energy_overlap", &temperature_schedule::energy_overlap)
+        .def("last", &temperature_schedule::last)
+        .def("next", &temperature_schedule::next)
+        .def("ramp", &temperature_schedule::ramp);
+
+    py::class_<axis_offsets>(m, "axis_offsets")
+        .def(py::init<crystal *, vec3>(), py::keep_alive<1, 2>())
+        .def("add_particle", &axis_offsets::add_particle, py::arg("p"), py::arg("state")=0)
+        .def("add_trace", &axis_offsets::add_trace, py::arg("cell"), py::arg("radius")=0.5)
+        .def("measure", &axis_offsets::measure)
+        .def("sum", &axis_offsets::sum)
+        .def("offsets", [](py::object self) {
+            axis_offsets & a = self.cast<axis_offsets &>();
+            return py::array_t<double>({(ssize_t)a.offsets.size()}, {(ssize_t)sizeof(double)}, a.offsets.data(), self);
+        }, "view of the last measurement, valid until the next measure()")
+        .def("__str__", &to_string<axis_offsets>);
+
+    py::class_<bcc_offsets>(m, "bcc_offsets")
+        .def(py::init<crystal *, lattice_cell *>(), py::keep_alive<1, 2>())
+        .def("measure", &bcc_offsets::measure)
+        .def("__str__", &to_string<bcc_offsets>);
+
+    py::class_<sc_offsets>(m, "sc_offsets")
+        .def(py::init<crystal *, lattice_cell *>(), py::keep_alive<1, 2>())
+        .def("measure", &sc_offsets::measure)
+        .def("__str__", &to_string<sc_offsets>);
+
+    py::class_<convergence_monitor::estimate>(m, "convergence_estimate")
+        .def_readonly("mean", &convergence_monitor::estimate::mean)
+        .def_readonly("error", &convergence_monitor::estimate::error)
+        .def_readonly("tau", &convergence_monitor::estimate::tau)
+        .def_readonly("effective_samples", &convergence_monitor::estimate::effective_samples);
+
+    py::class_<convergence_monitor>(m, "convergence_monitor")
+        .def(py::init<const std::vector<std::string> &, const std::vector<double> &, double>(),
+                py::arg("names"), py::arg("target_errors"), py::arg("target_samples")=100)
+        .def("add", &convergence_monitor::add)
+        .def("samples", &convergence_monitor::samples)
+        .def("mser", &convergence_monitor::mser)
+        .def("equilibration", &convergence_monitor::equilibration)
+        .def("measure", &convergence_monitor::measure)
+        .def("converged", &convergence_monitor::converged)
+        .def("__str__", &to_string<convergence_monitor>);
+
+    py::class_<histogram_run>(m, "histogram_run")
+        .def(py::init<>())
+        .def_readwrite("kbt", &histogram_run::kbt)
+        .def_readwrite("beta", &histogram_run::beta)
+        .def_readonly("energies", &histogram_run::energies)
+        .def_readonly("observables", &histogram_run::observables)
+        .def("add", &histogram_run::add)
+        .def("__len__", &histogram_run::size)
+        .def("write", &histogram_run::write)
+        .def_static("read", &histogram_run::read);
+
+    py::class_<histogram_reweighting::estimate>(m, "reweighted_estimate")
+        .def_readonly("beta", &histogram_reweighting::estimate::beta)
+        .def_readonly("effective_samples", &histogram_reweighting::estimate::effective_samples)
+        .def_readonly("mean", &histogram_reweighting::estimate::mean)
+        .def_readonly("error", &histogram_reweighting::estimate::error);
+
+    py::class_<histogram_reweighting>(m, "histogram_reweighting")
+        .def(py::init<>())
+        .def_readwrite("blocks", &histogram_reweighting::blocks)
+        .def_readwrite("tolerance", &histogram_reweighting::tolerance)
+        .def_readwrite("max_iterations", &histogram_reweighting::max_iterations)
+        .def_readonly("iterations", &histogram_reweighting::iterations)
+        .def("add", &histogram_reweighting::add)
+        .def("solve", &histogram_reweighting::solve, py::call_guard<py::gil_scoped_release>())
+        .def("at", &histogram_reweighting::at, py::call_guard<py::gil_scoped_release>())
+        .def("at_kbt", &histogram_reweighting::at_kbt, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<lattice_dynamics::profile>(m, "harmonic_profile")
+        .def_readonly("mean", &lattice_dynamics::profile::mean)
+        .def_readonly("variance", &lattice_dynamics::profile::variance)
+        .def_readonly("covariance", &lattice_dynamics::profile::covariance);
+
+    py::class_<lattice_dynamics>(m, "lattice_dynamics")
+        .def(py::init<crystal *, unsigned>(), py::arg("crystal"), py::arg("nthreads")=0, py::keep_alive<1, 2>(),
+                py::call_guard<py::gil_scoped_release>())
+        .def_readwrite("tolerance", &lattice_dynamics::tolerance)
+        .def_readwrite("max_iterations", &lattice_dynamics::max_iterations)
+        .def("__len__", &lattice_dynamics::size)
+        .def("nonzero_blocks", &lattice_dynamics::nonzero_blocks)
+        .def("mean_position", &lattice_dynamics::mean_position)
+        .def("local_covariance", [](const lattice_dynamics & h, const particle * p, double kt) {
+            matrix3 c = h.local_covariance(p, kt);
+            return std::vector<std::vector<double>>{
+                {c.row1.x, c.row1.y, c.row1.z}, {c.row2.x, c.row2.y, c.row2.z}, {c.row3.x, c.row3.y, c.row3.z}};
+        }, "3x3, kt times the inverse diagonal hessian block")
+        .def("response", &lattice_dynamics::response, py::arg("particle"), py::arg("direction"), py::arg("kt"),
+                py::arg("threads")=1, py::call_guard<py::gil_scoped_release>())
+        .def("predict", &lattice_dynamics::predict, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<fire_minimizer::result>(m, "fire_result")
+        .def_readonly("iterations", &fire_minimizer::result::iterations)
+        .def_readonly("energy", &fire_minimizer::result::energy)
+        .def_readonly("residual_force", &fire_minimizer::result::residual_force)
+        .def_readonly("wall_hits", &fire_minimizer::result::wall_hits)
+        .def_readonly("converged", &fire_minimizer::result::converged);
+
+    py::class_<fire_minimizer>(m, "fire_minimizer")
+        .def(py::init<crystal *>(), py::keep_alive<1, 2>())
+        .def("minimize", &fire_minimizer::minimize, py::arg("force_tolerance")=1e-6, py::arg("max_iterations")=10000,
+                py::call_guard<py::gil_scoped_release>());
+}
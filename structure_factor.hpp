@@ -0,0 +1,79 @@
+#ifndef STRUCTURE_FACTOR_HPP
+#define STRUCTURE_FACTOR_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "crystal.hpp"
+#include "parallel.hpp"
+
+class structure_factor {
+    /* S(k) = |sum_j exp(i k.r_j)|^2 / N on the reciprocal lattice of the
+     * periodic box, every k with 0 < |k| <= k_max */
+    crystal * crystalp;
+public:
+    double k_max;
+    unsigned nthreads;
+    int64_t nsamples = 0;
+    std::vector<vec3> wavevectors;
+    std::vector<double> sum; /* S(k) summed over samples */
+
+    structure_factor(crystal * crystalp, double k_max, unsigned nthreads=0) :
+        crystalp(crystalp), k_max(k_max), nthreads(nthreads) {
+        const auto & space = crystalp->space;
+        vec3 p1 = space.p1(), p2 = space.p2(), p3 = space.p3();
+        double volume = p1 * p2.cross(p3);
+        vec3 b1 = 2 * M_PI * p2.cross(p3) / volume;
+        vec3 b2 = 2 * M_PI * p3.cross(p1) / volume;
+        vec3 b3 = 2 * M_PI * p1.cross(p2) / volume;
+        /* k.p_i = 2 pi h_i, so |h_i| <= k_max |p_i| / 2 pi */
+        int h1 = k_max * p1.length() / (2 * M_PI);
+        int h2 = k_max * p2.length() / (2 * M_PI);
+        int h3 = k_max * p3.length() / (2 * M_PI);
+        for (int i = -h1; i <= h1; i++) {
+            for (int j = -h2; j <= h2; j++) {
+                for (int k = -h3; k <= h3; k++) {
+                    vec3 q = i * b1 + j * b2 + k * b3;
+                    double length = q.length();
+                    if (length == 0 || length > k_max) continue;
+                    wavevectors.push_back(q);
+                }
+            }
+        }
+        sum.assign(wavevectors.size(), 0);
+    }
+
+    void measure() {
+        std::vector<vec3> positions;
+        for (const particle * p : crystalp->particles) positions.push_back(crystalp->position(p));
+        double n = positions.size();
+        parallel_for(wavevectors.size(), nthreads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                double re = 0, im = 0;
+                for (const vec3 & x : positions) {
+                    double phase = wavevectors[i] * x;
+                    re += cos(phase);
+                    im += sin(phase);
+                }
+                sum[i] += (re * re + im * im) / n;
+            }
+        });
+        nsamples += 1;
+    }
+
+    /* binary: int32 nk, int64 nsamples, then per k: double kx, ky, kz, S */
+    void write(const std::string & filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        int32_t nk = wavevectors.size();
+        out.write((const char*)&nk, sizeof(nk));
+        out.write((const char*)&nsamples, sizeof(nsamples));
+        for (size_t i = 0; i < wavevectors.size(); i++) {
+            double record[4] = {wavevectors[i].x, wavevectors[i].y, wavevectors[i].z,
+                nsamples ? sum[i] / nsamples : 0};
+            out.write((const char*)record, sizeof(record));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,436 @@
+#ifndef SWEEP_RUNNER_HPP
+#define SWEEP_RUNNER_HPP
+
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "scenario.hpp"
+#include "fire_minimizer.hpp"
+#include "radial_distribution.hpp"
+#include "structure_factor.hpp"
+#include "bond_order.hpp"
+#include "displacement_field.hpp"
+#include "isobaric_moves.hpp"
+#include "snapshot_feed.hpp"
+#include "convergence.hpp"
+#include "histogram_reweighting.hpp"
+#include "lattice_dynamics.hpp"
+#include "thermodynamic_integration.hpp"
+
+std::string seqfn(int i) {
+    std::ostringstream s;
+    s << "opengl." << std::setfill('0') << std::setw(4) << i;
+    return s.str();
+}
+
+template<typename Str>
+std::string path_join(Str a) {
+    std::ostringstream s; s << a; return s.str(); }
+template<typename StrHead, typename... StrTail>
+std::string path_join(StrHead head, StrTail... tail) {
+     std::ostringstream s; s << head << "/" << path_join(tail...); return s.str(); }
+
+class sweep_runner {
+    /* work stealing: every worker pops from the back of its own queue and
+     * steals from the front of the others when it runs dry */
+    struct queue {
+        std::mutex lock;
+        std::deque<const scenario*> jobs;
+    };
+    std::vector<std::unique_ptr<queue>> queues;
+    unsigned analysis_threads = 1; /* cores per job left over for the analysis stages */
+
+    /* perfect crystals are built once per lattice and size and cloned per job */
+    std::mutex prototypes_lock;
+    std::map<std::string, std::shared_future<std::shared_ptr<const crystal>>> prototypes;
+
+    std::shared_ptr<const crystal> prototype(const scenario & s) {
+        std::promise<std::shared_ptr<const crystal>> promise;
+        std::shared_future<std::shared_ptr<const crystal>> future;
+        bool builder = false;
+        {
+            std::lock_guard<std::mutex> guard(prototypes_lock);
+            auto it = prototypes.find(s.prototype_key());
+            if (it == prototypes.end()) {
+                future = promise.get_future().share();
+                prototypes[s.prototype_key()] = future;
+                builder = true;
+            } else {
+                future = it->second;
+            }
+        }
+        if (builder) {
+            /* a failed build fails every job waiting on it */
+            try { promise.set_value(std::shared_ptr<const crystal>(s.build())); }
+            catch (...) { promise.set_exception(std::current_exception()); }
+        }
+        return future.get();
+    }
+
+    const scenario * next(size_t worker) {
+        {
+            queue & own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.jobs.empty()) {
+                const scenario * job = own.jobs.back();
+                own.jobs.pop_back();
+                return job;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            queue & victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                const scenario * job = victim.jobs.front();
+                victim.jobs.pop_front();
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    /* a job that throws leaves its message in an error file in its
+     * directory, the other jobs carry on */
+    void fail(const scenario & s, const std::string & dir, std::exception_ptr error) {
+        std::string message;
+        try { std::rethrow_exception(error); }
+        catch (const char * e) { message = e; }
+        catch (const std::exception & e) { message = e.what(); }
+        catch (...) { message = "unknown exception"; }
+        std::error_code ignored;
+        std::filesystem::create_directories(dir, ignored);
+        std::ofstream(path_join(dir, "error")) << message << std::endl;
+        std::cerr << "\n" << s.name << ": " << message << std::endl;
+    }
+
+    void run_one(const scenario & s, const std::string & dir) {
+        std::filesystem::create_directories(dir);
+        std::unique_ptr<crystal> crystal(prototype(s)->clone());
+        if (s.morton) crystal->reorder_morton();
+        monte_carlo monte_carlo(crystal.get(), s.seed);
+        monte_carlo.early_rejection = s.early_rejection;
+        monte_carlo.tries = s.tries;
+        monte_carlo.proposal_block = s.proposal_block;
+        monte_carlo.prefetch_distance = s.prefetch_distance;
+        lattice_cell * mid = s.setup(crystal.get(), monte_carlo);
+        std::ofstream validation_stream;
+        crystal->validation.fraction = s.validate;
+        crystal->validation.audit_every = s.audit_every;
+        crystal->validation.seed(s.seed);
+        if (s.validate > 0 || s.audit_every > 0) {
+            validation_stream.open(path_join(dir, "validation.log"));
+            crystal->validation.log = &validation_stream;
+        }
+        measurement offsets = s.make_measurement(crystal.get(), mid);
+        std::ofstream cutoff_stream;
+        if (s.cutoff_tolerance > 0) {
+            /* the fit of configure_hertz or configure_star in setup() */
+            const auto & fit = crystal->last_cutoff_fit;
+            cutoff_stream.open(path_join(dir, "cutoff"));
+            cutoff_stream << "cutoff " << fit.cutoff << "\n"
+                << "shift " << fit.shift << "\n"
+                << "truncation_error " << fit.truncation_error << "\n"
+                << "wigner_seitz_radius " << fit.wigner_seitz_radius << "\n"
+                << "face_distance " << fit.face_distance << "\n"
+                << "displacement_skin " << fit.displacement_skin << "\n"
+                << "neighbour_range " << fit.neighbour_range << "\n"
+                << "neighbour_cells " << fit.neighbour_cells << std::endl;
+        }
+        {
+            /* bytes per component and per site, after the neighbour range is final */
+            auto usage = crystal->memory();
+            std::ofstream memory_stream(path_join(dir, "memory"));
+            memory_stream << "compact " << crystal->compact_storage() << "\n"
+                << "sites " << usage.sites << "\n"
+                << "particles " << usage.particles << "\n"
+                << "positions " << usage.positions << "\n"
+                << "cells " << usage.cells << "\n"
+                << "lattice " << usage.lattice << "\n"
+                << "neighbour_lists " << usage.neighbour_lists << "\n"
+                << "stencils " << usage.stencils << "\n"
+                << "indices " << usage.indices << "\n"
+                << "total " << usage.total << "\n"
+                << "per_site " << (double)usage.total / usage.sites << std::endl;
+        }
+        if (s.relax) {
+            fire_minimizer minimizer(crystal.get());
+            auto result = minimizer.minimize(s.relax_tolerance);
+            std::ofstream relax_stream(path_join(dir, "relax"));
+            relax_stream << "iterations " << result.iterations << "\n"
+                << "energy " << result.energy << "\n"
+                << "residual_force " << result.residual_force << "\n"
+                << "wall_hits " << result.wall_hits << "\n"
+                << "converged " << result.converged << std::endl;
+        }
+        if (s.harmonic) {
+            /* per axis: label, then mean offset and variance per particle */
+            lattice_dynamics harmonic(crystal.get(), analysis_threads);
+            std::ofstream harmonic_stream(path_join(dir, "harmonic"));
+            for (const axis_offsets * axis : offsets.profiles()) {
+                auto profile = harmonic.predict(*axis, 1 / monte_carlo.beta);
+                harmonic_stream << "A" << axis->label;
+                for (size_t i = 0; i < profile.mean.size(); i++) {
+                    harmonic_stream << " " << profile.mean[i] << " " << profile.variance[i];
+                }
+                harmonic_stream << "\n";
+            }
+            harmonic_stream << std::flush;
+        }
+        if (s.free_energy > 0) {
+            /* the defect crystal and the perfect lattice in one pool, the
+             * formation free energy at fixed volume is F_d - N_d / N_p F_p */
+            thermodynamic_integration integration(s.free_energy);
+            integration.blocks = s.free_energy_blocks;
+            integration.sweeps = s.free_energy_sweeps;
+            integration.spring = s.free_energy_spring;
+            integration.nthreads = analysis_threads;
+            integration.seed = s.seed;
+            std::vector<const class crystal*> crystals = {crystal.get()};
+            std::unique_ptr<class crystal> perfect;
+            if (s.defect != scenario::NO_DEFECT) {
+                scenario reference = s;
+                reference.defect = scenario::NO_DEFECT;
+                perfect.reset(prototype(s)->clone());
+                class monte_carlo unused(perfect.get());
+                reference.setup(perfect.get(), unused);
+                crystals.push_back(perfect.get());
+            }
+            auto results = integration.run(crystals, monte_carlo.beta);
+            std::ofstream free_energy_stream(path_join(dir, "free_energy"));
+            thermodynamic_integration::write(free_energy_stream, results[0]);
+            if (perfect) {
+                double ratio = (double)results[0].particles / results[1].particles;
+                free_energy_stream << "# perfect\n";
+                thermodynamic_integration::write(free_energy_stream, results[1]);
+                free_energy_stream << "formation " << results[0].free_energy - ratio * results[1].free_energy << " "
+                    << sqrt(results[0].error * results[0].error + ratio * ratio * results[1].error * results[1].error)
+                    << std::endl;
+            }
+        }
+        if (s.write_frames) crystal->write(path_join(dir, seqfn(0)));
+        std::unique_ptr<radial_distribution> gr;
+        std::unique_ptr<structure_factor> sk;
+        std::unique_ptr<bond_order> bo;
+        std::unique_ptr<displacement_field> fields;
+        if (s.sample_every > 0) {
+            double r_max = s.gr_r_max > 0 ? s.gr_r_max : crystal->pair_range();
+            if (s.gr) gr.reset(new radial_distribution(crystal.get(), r_max, s.gr_bins, analysis_threads));
+            if (s.sk_k_max > 0) sk.reset(new structure_factor(crystal.get(), s.sk_k_max, analysis_threads));
+            if (s.bond_order) bo.reset(new bond_order(crystal.get(), s.bond_order_r_cut, s.bond_order_nearest, 100, analysis_threads));
+            if (s.fields) fields.reset(new displacement_field(crystal.get(), mid, analysis_threads));
+        }
+        std::unique_ptr<isobaric_moves> npt;
+        std::ofstream box_stream;
+        if (s.npt && s.histogram > 0) throw "sweep_runner: histogram reweighting needs constant volume";
+        if (s.npt && s.sk_k_max > 0) throw "sweep_runner: the structure factor wave vectors need a fixed box";
+        if (s.npt && s.fields) throw "sweep_runner: the strain and q grid of the fields need a fixed box";
+        if (s.npt) {
+            npt.reset(new isobaric_moves(crystal.get(), &monte_carlo, s.pressure, analysis_threads));
+            npt->ln_v_max = s.ln_v_max;
+            npt->ln_l_max = s.ln_v_max;
+            npt->shape_moves = s.shape_moves;
+            box_stream.open(path_join(dir, "box"));
+        }
+        std::unique_ptr<snapshot_publisher> live;
+        if (!s.live.empty()) {
+            live.reset(new snapshot_publisher(s.live, crystal->particles.size(), 4, s.live_interval));
+            live->publish(*crystal);
+        }
+        /* visit weights, redone after every training since the autocorrelation
+         * times change with the temperature, listed in name as particle id,
+         * cell n1 n2 n3 basis and weight */
+        auto plan_visits = [&](const std::string & name) {
+            if (s.visits == scenario::UNIFORM_VISITS) return;
+            std::vector<double> weights;
+            if (s.visits == scenario::DISTANCE_VISITS) {
+                weights = visit_schedule::by_distance(crystal.get(), s.visit_radius * s.a, s.visit_boost);
+            } else {
+                monte_carlo.visits.clear();
+                weights = visit_schedule::by_autocorrelation(monte_carlo.offset_autocorrelation(s.visit_sweeps), s.visit_boost);
+            }
+            monte_carlo.visits.set(weights);
+            std::ofstream visits_stream(path_join(dir, name));
+            for (size_t i = 0; i < crystal->particles.size(); i++) {
+                const particle * p = crystal->particles[i];
+                vec3 n = crystal->lattice_index(crystal->cell_of(p));
+                visits_stream << p->id << " " << n.x << " " << n.y << " " << n.z << " "
+                    << crystal->basis(crystal->cell_of(p)) << " " << monte_carlo.visits.weights[i] << "\n";
+            }
+            visits_stream << std::flush;
+        };
+        int block = 0; /* counts on across temperature plateaus */
+        std::vector<double> energies; /* per block of the last plateau, for the adaptive schedule and convergence */
+        std::vector<histogram_run> histograms; /* one per plateau */
+        /* runs up to nblocks, fewer when converge is set and the offset
+         * observables and the energy converged, the estimate goes to
+         * convergence_name and the joint samples to histogram_name */
+        auto run_blocks = [&](std::ostream & log_stream, const std::string & convergence_name,
+                const std::string & histogram_name, double kbt) {
+            energies.clear();
+            histogram_run * histogram = nullptr;
+            if (s.histogram > 0) {
+                histograms.emplace_back();
+                histogram = &histograms.back();
+                histogram->kbt = kbt;
+                histogram->beta = monte_carlo.beta;
+            }
+            std::unique_ptr<convergence_monitor> monitor;
+            if (s.converge) {
+                offsets.measure();
+                std::vector<std::string> names;
+                std::vector<double> targets;
+                for (size_t k = 0; k < offsets.observables().size(); k++) {
+                    names.push_back("offsets" + std::to_string(k));
+                    targets.push_back(s.target_error);
+                }
+                names.push_back("energy");
+                targets.push_back(0);
+                monitor.reset(new convergence_monitor(names, targets, s.target_samples));
+            }
+            bool measure_energy = monitor || (s.schedule && s.schedule_type == temperature_schedule::ADAPTIVE);
+            for (int i = 0; i < s.nblocks; i++) {
+                if (s.sample_every > 0 || npt || live || histogram) {
+                    for (int sweep = 0; sweep < s.nsweeps; sweep++) {
+                        monte_carlo.sweep_sym(1);
+                        if (npt) npt->sweep(s.box_moves);
+                        if (live) live->maybe_publish(*crystal);
+                        if (histogram && (i * s.nsweeps + sweep + 1) % s.histogram == 0) {
+                            offsets.measure();
+                            histogram->add(crystal->total_energy(), offsets.observables());
+                        }
+                        if (s.sample_every <= 0 || (block * s.nsweeps + sweep + 1) % s.sample_every != 0) continue;
+                        if (gr) gr->measure();
+                        if (sk) sk->measure();
+                        if (bo) bo->measure();
+                        if (fields) fields->measure();
+                    }
+                } else {
+                    monte_carlo.sweep_sym(s.nsweeps);
+                }
+                if (s.write_frames) crystal->write(path_join(dir, seqfn(block+1)));
+                offsets.measure();
+                offsets.write(log_stream);
+                if (npt) {
+                    box_stream << block << " " << crystal->space.volume() << " " << crystal->density() << " "
+                        << (npt->ntries ? (double)npt->naccept / npt->ntries : 0) << std::endl;
+                }
+                if (measure_energy) energies.push_back(crystal->total_energy());
+                block += 1;
+                blocks_done += 1;
+                if (monitor) {
+                    auto values = offsets.observables();
+                    values.push_back(energies.back());
+                    monitor->add(values);
+                    if (i + 1 >= s.min_blocks && monitor->converged()) break;
+                }
+            }
+            if (monitor) {
+                std::ofstream convergence_stream(path_join(dir, convergence_name));
+                monitor->write(convergence_stream);
+            }
+            if (histogram) histogram->write(path_join(dir, histogram_name));
+        };
+        if (!s.schedule) {
+            std::ofstream log_stream(path_join(dir, s.log_name));
+            monte_carlo.train();
+            plan_visits("visits");
+            run_blocks(log_stream, "convergence", "histogram.bin", s.initial_kbt());
+        } else {
+            /* one warm started run over all plateaus, offsets of plateau i go
+             * to log_name.i and the schedule file lists the plateaus */
+            temperature_schedule schedule(s.schedule_type, s.initial_kbt(), s.kbt_to, s.stages);
+            schedule.energy_overlap = s.energy_overlap;
+            std::ofstream schedule_stream(path_join(dir, "schedule"));
+            double kbt = schedule.kbt_from;
+            for (int stage = 0;; stage++) {
+                set_temperature(crystal.get(), monte_carlo, kbt);
+                monte_carlo.train();
+                plan_visits("visits." + std::to_string(stage));
+                std::ofstream log_stream(path_join(dir, s.log_name + "." + std::to_string(stage)));
+                run_blocks(log_stream, "convergence." + std::to_string(stage),
+                        "histogram.bin." + std::to_string(stage), kbt);
+                double mean = 0, variance = 0;
+                for (double e : energies) mean += e / energies.size();
+                for (double e : energies) variance += (e - mean) * (e - mean) / std::max<size_t>(1, energies.size() - 1);
+                schedule_stream << stage << " " << kbt << " " << monte_carlo.beta << " " << monte_carlo.r_max;
+                if (!energies.empty()) schedule_stream << " " << mean << " " << sqrt(variance);
+                schedule_stream << std::endl;
+                if (s.checkpoint) {
+                    write_checkpoint(path_join(dir, "checkpoint." + std::to_string(stage)), crystal.get(), monte_carlo);
+                }
+                if (schedule.last(stage, kbt)) break;
+                double next = schedule.next(stage, kbt, sqrt(variance));
+                for (int sweep = 0; sweep < s.ramp_sweeps; sweep++) {
+                    set_temperature(crystal.get(), monte_carlo, schedule.ramp(kbt, next, (sweep + 1.) / s.ramp_sweeps));
+                    monte_carlo.sweep_sym(1);
+                    if (npt) npt->sweep(s.box_moves);
+                    if (live) live->maybe_publish(*crystal);
+                }
+                kbt = next;
+            }
+        }
+        if (!histograms.empty() && !s.reweight_kbt.empty()) {
+            /* single histogram for one run, multiple histogram over the plateaus of a schedule */
+            histogram_reweighting reweighting;
+            /* a kbt = 0 plateau of a quench can not be reweighted, the others still can */
+            for (const auto & h : histograms) if (std::isfinite(h.beta) && h.kbt > 0) reweighting.add(h);
+            if (reweighting.run_count() == 0) throw "sweep_runner: reweight_kbt needs a plateau at kbt > 0";
+            std::ofstream reweighted_stream(path_join(dir, "reweighted"));
+            reweighting.write(reweighted_stream, s.reweight_kbt);
+        }
+        if (cutoff_stream.is_open()) {
+            cutoff_stream << "final_displacement_skin " << crystal->displacement_skin << "\n"
+                << "final_neighbour_range " << crystal->neighbour_range << std::endl;
+        }
+        if (validation_stream.is_open()) {
+            std::ofstream summary(path_join(dir, "validation"));
+            crystal->validation.write(summary);
+        }
+        if (gr) gr->write(path_join(dir, "gr.bin"));
+        if (sk) sk->write(path_join(dir, "sk.bin"));
+        if (bo) bo->write_histograms(path_join(dir, "bond_order_histogram.bin"));
+        if (bo) bo->write_particles(path_join(dir, "bond_order.bin"));
+        if (fields) fields->write(path_join(dir, "fields.bin"));
+    }
+
+public:
+    std::atomic<int> blocks_done{0};
+    std::atomic<int> jobs_done{0};
+    std::atomic<int> jobs_failed{0}; /* counted in jobs_done too */
+
+    /* runs every scenario in its own directory root/name, or directly
+     * in root when there is only one */
+    void run(const std::vector<scenario> & jobs, const std::string & root, unsigned nthreads=0) {
+        if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+        unsigned cores = nthreads;
+        nthreads = std::min<unsigned>(nthreads, std::max<size_t>(jobs.size(), 1));
+        analysis_threads = std::max(1u, cores / nthreads);
+        queues.clear();
+        for (unsigned i = 0; i < nthreads; i++) queues.emplace_back(new queue());
+        for (size_t i = 0; i < jobs.size(); i++) queues[i % nthreads]->jobs.push_back(&jobs[i]);
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < nthreads; w++) {
+            workers.emplace_back([&, w]() {
+                while (const scenario * job = next(w)) {
+                    std::string dir = jobs.size() == 1 ? root : path_join(root, job->name);
+                    try { run_one(*job, dir); }
+                    catch (...) {
+                        fail(*job, dir, std::current_exception());
+                        jobs_failed += 1;
+                    }
+                    jobs_done += 1;
+                }
+            });
+        }
+        for (auto & worker : workers) worker.join();
+        prototypes.clear();
+    }
+};
+
+#endif
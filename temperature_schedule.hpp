@@ -0,0 +1,135 @@
+#ifndef TEMPERATURE_SCHEDULE_HPP
+#define TEMPERATURE_SCHEDULE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "crystal.hpp"
+#include "monte_carlo.hpp"
+
+/* sets beta for kbt in units of the potential energy scale, for the star
+ * potential kbt = 1 is the temperature absorbed in its prefactor */
+void set_temperature(crystal * crystal, monte_carlo & monte_carlo, double kbt) {
+    if (crystal->potential_type == crystal::potential_type::HERTZ) {
+        monte_carlo.beta = 1./(kbt*crystal->potential_epsilon);
+    } else {
+        monte_carlo.beta = 1./kbt;
+    }
+}
+
+class temperature_schedule {
+    /* a sequence of temperature plateaus from kbt_from to kbt_to, cooling
+     * or heating. LINEAR and GEOMETRIC space nstages plateaus evenly in kbt
+     * or ln kbt. ADAPTIVE steps in beta so that |dbeta| * stddev(E) of the
+     * last plateau equals energy_overlap, which keeps neighbouring energy
+     * distributions overlapping: small steps where the heat capacity is
+     * large, big steps elsewhere */
+public:
+    enum kind { LINEAR, GEOMETRIC, ADAPTIVE };
+    kind type = LINEAR;
+    double kbt_from, kbt_to;
+    int nstages = 5; /* plateaus including both ends, the maximum for ADAPTIVE */
+    double energy_overlap = 1;
+
+    temperature_schedule(kind type, double kbt_from, double kbt_to, int nstages=5) :
+        type(type), kbt_from(kbt_from), kbt_to(kbt_to), nstages(nstages) {
+        if (!(kbt_from > 0 && kbt_to > 0)) throw "temperature_schedule: kbt has to be positive";
+        if (nstages < 1) throw "temperature_schedule: need at least one stage";
+    }
+
+    bool last(int stage, double kbt) const {
+        return stage + 1 >= nstages || kbt == kbt_to;
+    }
+
+    /* kbt of the plateau after stage, energy_stddev was measured at kbt */
+    double next(int stage, double kbt, double energy_stddev) const {
+        if (stage + 2 >= nstages) return kbt_to;
+        double x = (stage + 1.) / (nstages - 1);
+        if (type == LINEAR) return kbt_from + x * (kbt_to - kbt_from);
+        if (type == GEOMETRIC) return kbt_from * pow(kbt_to / kbt_from, x);
+        double beta = 1 / kbt, beta_to = 1 / kbt_to;
+        if (!(energy_stddev > 0)) return kbt_to;
+        double dbeta = energy_overlap / energy_stddev;
+        if (dbeta >= abs(beta_to - beta)) return kbt_to;
+        return 1 / (beta + (beta_to > beta ? dbeta : -dbeta));
+    }
+
+    /* kbt at fraction x of the ramp between two plateaus */
+    double ramp(double from, double to, double x) const {
+        if (type == LINEAR) return from + x * (to - from);
+        if (type == GEOMETRIC) return from * pow(to / from, x);
+        return 1 / (1 / from + x * (1 / to - 1 / from));
+    }
+};
+
+/* binary: char[8] "SSCHECK1", int64 n, double beta, r_max, box[9] (p1, p2, p3),
+ * int64 rng state length, rng state as text, then per particle int32 id, double x, y, z
+ * in crystal->particles order */
+void write_checkpoint(const std::string & filename, const crystal * crystal, const monte_carlo & monte_carlo) {
+    std::ofstream out(filename, std::ios::binary);
+    out.write("SSCHECK1", 8);
+    int64_t n = crystal->particles.size();
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)&monte_carlo.beta, sizeof(double));
+    out.write((const char*)&monte_carlo.r_max, sizeof(double));
+    vec3 p[3] = {crystal->space.p1(), crystal->space.p2(), crystal->space.p3()};
+    for (int i = 0; i < 3; i++) {
+        double v[3] = {p[i].x, p[i].y, p[i].z};
+        out.write((const char*)v, sizeof(v));
+    }
+    std::ostringstream rng;
+    rng << monte_carlo.rng;
+    int64_t length = rng.str().size();
+    out.write((const char*)&length, sizeof(length));
+    out.write(rng.str().data(), length);
+    for (const particle * q : crystal->particles) {
+        int32_t id = q->id;
+        vec3 x = crystal->position(q);
+        double v[3] = {x.x, x.y, x.z};
+        out.write((const char*)&id, sizeof(id));
+        out.write((const char*)v, sizeof(v));
+    }
+}
+
+/* restores positions, box, beta, r_max and the random stream into a crystal
+ * set up by the same scenario as the one that wrote the checkpoint */
+void read_checkpoint(const std::string & filename, crystal * crystal, monte_carlo & monte_carlo) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[8];
+    in.read(magic, 8);
+    if (!in || std::string(magic, 8) != "SSCHECK1") throw "read_checkpoint: not a checkpoint";
+    int64_t n;
+    in.read((char*)&n, sizeof(n));
+    if (n != (int64_t)crystal->particles.size()) throw "read_checkpoint: particle count differs";
+    in.read((char*)&monte_carlo.beta, sizeof(double));
+    in.read((char*)&monte_carlo.r_max, sizeof(double));
+    vec3 p[3];
+    for (int i = 0; i < 3; i++) {
+        double v[3];
+        in.read((char*)v, sizeof(v));
+        p[i] = vec3(v[0], v[1], v[2]);
+    }
+    int64_t length;
+    in.read((char*)&length, sizeof(length));
+    std::string state(length, ' ');
+    in.read(&state[0], length);
+    std::istringstream(state) >> monte_carlo.rng;
+    vec3 extents = crystal->space.extents();
+    crystal->scale_box(periodic_space(matrix3::from_cols(p[0] / extents.x, p[1] / extents.y, p[2] / extents.z), extents));
+    for (particle * q : crystal->particles) {
+        int32_t id;
+        double v[3];
+        in.read((char*)&id, sizeof(id));
+        in.read((char*)v, sizeof(v));
+        if (id != q->id) throw "read_checkpoint: particle order differs";
+        crystal->place(q, vec3(v[0], v[1], v[2]));
+    }
+    if (!in) throw "read_checkpoint: truncated";
+    crystal->box_changed();
+    crystal->cover_all();
+    crystal->select_kernels();
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef THERMODYNAMIC_INTEGRATION_HPP
+#define THERMODYNAMIC_INTEGRATION_HPP
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "crystal.hpp"
+#include "monte_carlo.hpp"
+#include "convergence.hpp"
+#include "parallel.hpp"
+
+class thermodynamic_integration {
+    /* frenkel ladd free energy of a crystal in its wigner seitz cells.
+     * every particle is tied to its cell centre c by a spring and the pair
+     * energy U is switched on with lambda,
+     *   H(lambda) = lambda U + (1 - lambda) k sum |r - c|^2,
+     * so that H(0) is an einstein crystal with the free energy
+     *   F_E = -3N/(2 beta) ln(pi / (beta k))
+     * and H(1) the crystal itself:
+     *   F = F_E + int_0^1 <U - k sum |r - c|^2>_lambda dlambda.
+     * the windows move single particles, the centre of mass is free in both
+     * ends and F_E needs no correction for it. with a stiff spring the
+     * integrand runs like -3N / (2 beta mu) in the spring fraction
+     * mu = 1 - lambda until the cell walls take over, so the integral is a
+     * gauss legendre sum in ln(mu + c), c = k_fit / k, in which it is
+     * smooth. a second sum over half the nodes estimates the quadrature
+     * error. every window is its own clone and monte carlo run, all windows
+     * of all crystals shared out over the threads as they come free. F_E
+     * ignores the cell walls, the mass of the einstein gaussians outside
+     * the inscribed sphere bounds that error and is reported as wall_error */
+public:
+    struct window {
+        double lambda;
+        double weight; /* quadrature weight on [0, 1] */
+        double mean; /* <U - k sum |r - c|^2> */
+        double error;
+        double tau; /* in blocks */
+        double r_max;
+    };
+
+private:
+    /* legendre nodes and weights on [-1, 1] by newton iteration */
+    static void gauss_legendre(int n, std::vector<double> & nodes, std::vector<double> & weights) {
+        nodes.assign(n, 0);
+        weights.assign(n, 0);
+        for (int i = 0; i < (n + 1) / 2; i++) {
+            double x = cos(M_PI * (i + 0.75) / (n + 0.5));
+            double derivative = 1;
+            for (int iteration = 0; iteration < 100; iteration++) {
+                double p0 = 1, p1 = x;
+                for (int k = 2; k <= n; k++) {
+                    double p2 = ((2*k - 1) * x * p1 - (k - 1) * p0) / k;
+                    p0 = p1;
+                    p1 = p2;
+                }
+                derivative = n * (x * p1 - p0) / (x * x - 1);
+                double dx = p1 / derivative;
+                x -= dx;
+                if (std::abs(dx) < 1e-15) break;
+            }
+            nodes[i] = -x;
+            nodes[n - 1 - i] = x;
+            weights[i] = weights[n - 1 - i] = 2 / ((1 - x * x) * derivative * derivative);
+        }
+    }
+
+    /* n windows with lambda and their weight on [0, 1] set, the nodes
+     * evenly spaced in ln(1 - lambda + offset) */
+    static std::vector<window> quadrature(int n, double offset) {
+        std::vector<double> nodes, weights;
+        gauss_legendre(n, nodes, weights);
+        double from = log(offset), length = log1p(1 / offset);
+        std::vector<window> ret(n);
+        for (int i = 0; i < n; i++) {
+            double mu = exp(from + length * (nodes[i] + 1) / 2) - offset;
+            ret[i].lambda = std::min(std::max(1 - mu, 0.), 1.);
+            ret[i].weight = weights[i] / 2 * length * (mu + offset);
+        }
+        return ret;
+    }
+
+    static double springs(const crystal * crystalp) {
+        double ret = 0;
+        for (const particle * p : crystalp->particles) {
+            vec3 x = crystalp->offset(p);
+            ret += x * x;
+        }
+        return ret;
+    }
+
+    /* half the closest distance between neighbouring cell centres */
+    static double inscribed_radius(const crystal * crystalp) {
+        double ret = INFINITY;
+        for (const lattice_cell * cell : crystalp->cells) {
+            for (const lattice_cell * nn : crystalp->neighbours(cell)) {
+                ret = std::min(ret, crystalp->space.distance(crystalp->center(cell), crystalp->center(nn)) / 2);
+            }
+        }
+        return ret;
+    }
+
+public:
+    struct result {
+        size_t particles;
+        double spring;
+        double einstein; /* F_E */
+        double offset; /* c of the ln(1 - lambda + c) nodes */
+        double integral;
+        double integral_error; /* statistical */
+        double coarse_integral; /* over half the nodes */
+        double quadrature_error; /* |integral - coarse_integral| */
+        double wall_error; /* bound on the error of F_E from the cell walls */
+        double free_energy;
+        double error;
+        std::vector<window> windows;
+        std::vector<window> coarse;
+    };
+
+    int windows = 8; /* gauss legendre nodes, plus windows / 2 for the quadrature error */
+    int equilibration_sweeps = 200; /* per window after training */
+    int blocks = 100; /* samples per window, one at the end of every block */
+    int sweeps = 10; /* per block */
+    double spring = 0; /* k, 0 matches the einstein mean square displacement to the crystal */
+    unsigned nthreads = 0;
+    unsigned seed = 0;
+
+    thermodynamic_integration(int windows=8) : windows(windows) { }
+
+    /* k = 3 / (2 beta <|r - c|^2>) over the cells holding one particle, in a
+     * run of the coupled crystal at beta, so the einstein crystal has the
+     * fluctuations of the bulk */
+    double fit_spring(const crystal * prototype, double beta, int nsweeps=200) const {
+        std::unique_ptr<crystal> c(prototype->clone());
+        monte_carlo mc(c.get(), seed);
+        mc.beta = beta;
+        mc.train(false);
+        double sum = 0;
+        size_t count = 0;
+        for (int sweep = 0; sweep < 2 * nsweeps; sweep++) {
+            mc.sweep_1p(1);
+            if (sweep < nsweeps) continue;
+            for (const particle * p : c->particles) {
+                if (c->members(c->cell_of(p)).size() != 1) continue;
+                vec3 x = c->offset(p);
+                sum += x * x;
+                count += 1;
+            }
+        }
+        if (!(sum > 0)) throw "thermodynamic_integration: particles did not move";
+        return 1.5 * count / (beta * sum);
+    }
+
+    /* free energies of every crystal at beta, kernels have to be selected.
+     * the spring is fitted on the last crystal, pass the perfect lattice
+     * there so defect and reference share it. it is used as k with spring
+     * left at 0 and sets c otherwise */
+    std::vector<result> run(const std::vector<const crystal*> & crystals, double beta) {
+        if (crystals.empty()) return {};
+        if (windows < 2) throw "thermodynamic_integration: need at least two windows";
+        double fitted = fit_spring(crystals.back(), beta, equilibration_sweeps);
+        double k = spring > 0 ? spring : fitted;
+        std::vector<window> fine = quadrature(windows, fitted / k);
+        std::vector<window> coarse = quadrature(windows / 2, fitted / k);
+        std::vector<result> ret(crystals.size());
+        for (size_t c = 0; c < crystals.size(); c++) {
+            ret[c].particles = crystals[c]->particles.size();
+            ret[c].spring = k;
+            ret[c].offset = fitted / k;
+            ret[c].windows = fine;
+            ret[c].coarse = coarse;
+        }
+        std::atomic<size_t> next(0);
+        size_t per_crystal = fine.size() + coarse.size();
+        size_t jobs = crystals.size() * per_crystal;
+        parallel_for(jobs, nthreads, [&](size_t, size_t, unsigned) {
+            for (size_t job; (job = next++) < jobs;) {
+                size_t c = job / per_crystal;
+                size_t w = job % per_crystal;
+                window & out = w < fine.size() ? ret[c].windows[w] : ret[c].coarse[w - fine.size()];
+                std::unique_ptr<crystal> clone(crystals[c]->clone());
+                monte_carlo mc(clone.get(), seed + job);
+                mc.beta = beta;
+                mc.lambda = out.lambda;
+                mc.spring = (1 - mc.lambda) * k;
+                mc.train(false);
+                mc.sweep_1p(equilibration_sweeps);
+                convergence_monitor monitor({"integrand"}, {0});
+                for (int b = 0; b < blocks; b++) {
+                    mc.sweep_1p(sweeps);
+                    monitor.add({clone->total_energy() - k * springs(clone.get())});
+                }
+                auto e = monitor.measure(0, monitor.equilibration());
+                out.mean = e.mean;
+                out.error = e.error;
+                out.tau = e.tau;
+                out.r_max = mc.r_max;
+            }
+        });
+        for (size_t c = 0; c < crystals.size(); c++) {
+            result & r = ret[c];
+            double n = r.particles;
+            r.einstein = -1.5 * n / beta * log(M_PI / (beta * k));
+            r.integral = 0;
+            double variance = 0;
+            for (const window & w : r.windows) {
+                r.integral += w.weight * w.mean;
+                variance += w.weight * w.weight * w.error * w.error;
+            }
+            r.integral_error = sqrt(variance);
+            r.coarse_integral = 0;
+            for (const window & w : r.coarse) r.coarse_integral += w.weight * w.mean;
+            r.quadrature_error = std::abs(r.integral - r.coarse_integral);
+            /* P(|x| > R) of a 3d gaussian with variance 1 / (2 beta k) per axis */
+            double z = inscribed_radius(crystals[c]) * sqrt(2 * beta * k);
+            double outside = erfc(z / sqrt(2.)) + sqrt(2 / M_PI) * z * exp(-z * z / 2);
+            r.wall_error = -n / beta * log1p(-std::min(outside, 0.5));
+            r.free_energy = r.einstein + r.integral;
+            r.error = sqrt(variance + r.quadrature_error * r.quadrature_error);
+        }
+        return ret;
+    }
+
+    static void write(std::ostream & out, const result & r) {
+        out << "particles " << r.particles << "\n"
+            << "spring " << r.spring << "\n"
+            << "einstein " << r.einstein << "\n"
+            << "offset " << r.offset << "\n"
+            << "integral " << r.integral << " " << r.integral_error << "\n"
+            << "coarse_integral " << r.coarse_integral << "\n"
+            << "quadrature_error " << r.quadrature_error << "\n"
+            << "wall_error " << r.wall_error << "\n"
+            << "free_energy " << r.free_energy << " " << r.error << "\n"
+            << "# lambda weight mean error tau r_max\n";
+        for (const window & w : r.windows) {
+            out << w.lambda << " " << w.weight << " " << w.mean << " " << w.error << " "
+                << w.tau << " " << w.r_max << "\n";
+        }
+        out << "# coarse lambda weight mean error tau r_max\n";
+        for (const window & w : r.coarse) {
+            out << w.lambda << " " << w.weight << " " << w.mean << " " << w.error << " "
+                << w.tau << " " << w.r_max << "\n";
+        }
+        out << std::flush;
+    }
+};
+
+#endif
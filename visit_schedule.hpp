@@ -0,0 +1,105 @@
+#ifndef VISIT_SCHEDULE_HPP
+#define VISIT_SCHEDULE_HPP
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "crystal.hpp"
+
+class visit_schedule {
+    /* how often each particle is picked for a trial move. a sweep makes
+     * as many moves as there are particles, each on a particle drawn with
+     * probability weight / sum of weights from a walker alias table. the
+     * weights are fixed while they are in use and do not depend on the
+     * positions, so every move is still a symmetric metropolis step and the
+     * mixture keeps detailed balance, only the cpu time is redistributed */
+    std::vector<double> probability;
+    std::vector<size_t> alias;
+
+public:
+    std::vector<double> weights; /* per particle in crystal->particles order, mean 1 */
+
+    bool empty() const {
+        return weights.empty();
+    }
+
+    size_t size() const {
+        return weights.size();
+    }
+
+    void clear() {
+        weights.clear();
+        probability.clear();
+        alias.clear();
+    }
+
+    void set(const std::vector<double> & w) {
+        size_t n = w.size();
+        double total = 0;
+        for (double v : w) {
+            if (!(v > 0)) throw "visit_schedule: weights must be positive";
+            total += v;
+        }
+        weights.resize(n);
+        for (size_t i = 0; i < n; i++) weights[i] = w[i] * n / total;
+        probability = weights;
+        alias.assign(n, 0);
+        std::vector<size_t> small, large;
+        for (size_t i = 0; i < n; i++) (probability[i] < 1 ? small : large).push_back(i);
+        while (!small.empty() && !large.empty()) {
+            size_t s = small.back(), l = large.back();
+            small.pop_back();
+            alias[s] = l;
+            probability[l] -= 1 - probability[s];
+            if (probability[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        /* leftovers are 1 up to rounding */
+        for (size_t i : small) probability[i] = 1;
+        for (size_t i : large) probability[i] = 1;
+    }
+
+    template<typename Rng>
+    size_t draw(Rng & rng) const {
+        size_t i = std::uniform_int_distribution<size_t>(0, probability.size() - 1)(rng);
+        return std::uniform_real_distribution<double>(0, 1)(rng) < probability[i] ? i : alias[i];
+    }
+
+    /* cells holding other than one particle, the interstitials and vacancies */
+    static std::vector<const lattice_cell*> defect_cells(const crystal * crystalp) {
+        std::vector<const lattice_cell*> ret;
+        for (const lattice_cell * cell : crystalp->cells) {
+            if (crystalp->members(cell).size() != 1) ret.push_back(cell);
+        }
+        return ret;
+    }
+
+    /* boost for particles whose cell centre lies within radius of a defect
+     * cell centre, 1 for the bulk */
+    static std::vector<double> by_distance(const crystal * crystalp, double radius, double boost) {
+        auto defects = defect_cells(crystalp);
+        std::vector<double> ret;
+        for (const particle * p : crystalp->particles) {
+            bool near = false;
+            for (const lattice_cell * cell : defects) {
+                near = near || crystalp->space.difference(crystalp->center(cell), crystalp->center(crystalp->cell_of(p))).length() <= radius;
+            }
+            ret.push_back(near ? boost : 1);
+        }
+        return ret;
+    }
+
+    /* weights proportional to measured autocorrelation times (see
+     * monte_carlo::offset_autocorrelation), clipped to [1, boost] so noisy
+     * estimates in the bulk neither starve nor flood it */
+    static std::vector<double> by_autocorrelation(const std::vector<double> & times, double boost) {
+        std::vector<double> ret;
+        for (double t : times) ret.push_back(std::min(std::max(t, 1.), boost));
+        return ret;
+    }
+};
+
+#endif